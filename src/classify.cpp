@@ -0,0 +1,273 @@
+// Vectorized classification of grid values and cells; see classify.h.
+// The x86 kernels are compiled with function-level target attributes, so
+// the package itself doesn't need to be built with any special flags.
+
+#include "classify.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CLASSIFY_X86
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+// whether a grid value is a regular number, as opposed to NA, NaN, or infinite;
+// integer grids come from R, which uses the smallest int as NA, and 16-bit
+// grids have no missing values
+inline bool is_finite_value(double v) {return isfinite(v);}
+inline bool is_finite_value(float v) {return isfinite(v);}
+inline bool is_finite_value(int32_t v) {return v != INT32_MIN;}
+inline bool is_finite_value(int16_t) {return true;}
+
+template <class T>
+void classify_points_scalar(const T *z, int n, double vlo, double vhi, unsigned char *out) {
+  for (int i = 0; i < n; i++) {
+    double v = z[i];
+    out[i] = is_finite_value(z[i]) ? (v >= vlo && v < vhi) + 2*(v >= vhi) : class_na;
+  }
+}
+
+template <int base>
+void combine_cells_scalar(const unsigned char *left, const unsigned char *right, int n, unsigned char *cells) {
+  for (int r = 0; r < n; r++) {
+    unsigned char a = left[r], b = right[r], c = right[r + 1], d = left[r + 1];
+    cells[r] = ((a | b | c | d) & class_na) ? 0 : ((a*base + b)*base + c)*base + d;
+  }
+}
+
+#ifdef CLASSIFY_X86
+
+// byte i of spread_bits[m] is 1 if bit i of m is set, 0 otherwise
+struct bit_spreader {
+  uint64_t table[256];
+
+  bit_spreader() {
+    for (int m = 0; m < 256; m++) {
+      table[m] = 0;
+      for (int i = 0; i < 8; i++) {
+        if (m & (1 << i)) table[m] |= uint64_t(1) << (8*i);
+      }
+    }
+  }
+};
+const bit_spreader spread_bits;
+
+// turns the comparison bit masks of 8 consecutive values into their 8 classes,
+// in the byte order of x86 (little endian)
+inline uint64_t pack_classes(unsigned m_lo, unsigned m_hi, unsigned m_finite) {
+  uint64_t t = spread_bits.table[m_lo & ~m_hi & 0xff] | (spread_bits.table[m_hi] << 1);
+  uint64_t na = spread_bits.table[~m_finite & 0xff];
+  return (t & ~(na * 0xff)) | (na << 7);
+}
+
+__attribute__((target("sse2")))
+void classify_points_sse2(const double *z, int n, double vlo, double vhi, unsigned char *out) {
+  const __m128d lo = _mm_set1_pd(vlo), hi = _mm_set1_pd(vhi), inf = _mm_set1_pd(INFINITY);
+  const __m128d abs_mask = _mm_castsi128_pd(_mm_set1_epi64x(0x7fffffffffffffffLL));
+
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    unsigned m_lo = 0, m_hi = 0, m_finite = 0;
+    for (int k = 0; k < 4; k++) {
+      __m128d v = _mm_loadu_pd(z + i + 2*k);
+      m_lo |= _mm_movemask_pd(_mm_cmpge_pd(v, lo)) << (2*k);
+      m_hi |= _mm_movemask_pd(_mm_cmpge_pd(v, hi)) << (2*k);
+      // |v| < Inf is false for infinite values and NaN
+      m_finite |= _mm_movemask_pd(_mm_cmplt_pd(_mm_and_pd(v, abs_mask), inf)) << (2*k);
+    }
+    uint64_t t = pack_classes(m_lo, m_hi, m_finite);
+    memcpy(out + i, &t, 8);
+  }
+  classify_points_scalar(z + i, n - i, vlo, vhi, out + i);
+}
+
+__attribute__((target("sse2")))
+inline __m128i times_base_sse2(__m128i v, int base) {
+  __m128i v2 = _mm_add_epi8(v, v);
+  return base == 3 ? _mm_add_epi8(v2, v) : v2;
+}
+
+template <int base>
+__attribute__((target("sse2")))
+void combine_cells_sse2(const unsigned char *left, const unsigned char *right, int n, unsigned char *cells) {
+  const __m128i na = _mm_set1_epi8((char)class_na), zero = _mm_setzero_si128();
+
+  int r = 0;
+  for (; r + 16 <= n; r += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(left + r));
+    __m128i b = _mm_loadu_si128((const __m128i *)(right + r));
+    __m128i c = _mm_loadu_si128((const __m128i *)(right + r + 1));
+    __m128i d = _mm_loadu_si128((const __m128i *)(left + r + 1));
+
+    __m128i any_na = _mm_and_si128(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d)), na);
+    __m128i code = _mm_add_epi8(times_base_sse2(a, base), b);
+    code = _mm_add_epi8(times_base_sse2(code, base), c);
+    code = _mm_add_epi8(times_base_sse2(code, base), d);
+    code = _mm_and_si128(code, _mm_cmpeq_epi8(any_na, zero));
+    _mm_storeu_si128((__m128i *)(cells + r), code);
+  }
+  combine_cells_scalar<base>(left + r, right + r, n - r, cells + r);
+}
+
+// load8_avx2() loads 8 consecutive grid values, converted to double, into v0
+// and v1, and returns the bit mask of those that are finite
+__attribute__((target("avx2")))
+inline unsigned finite_mask_avx2(__m256d v0, __m256d v1) {
+  const __m256d abs_mask = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7fffffffffffffffLL));
+  const __m256d inf = _mm256_set1_pd(INFINITY);
+  // |v| < Inf is false for infinite values and NaN
+  return _mm256_movemask_pd(_mm256_cmp_pd(_mm256_and_pd(v0, abs_mask), inf, _CMP_LT_OQ)) |
+    (_mm256_movemask_pd(_mm256_cmp_pd(_mm256_and_pd(v1, abs_mask), inf, _CMP_LT_OQ)) << 4);
+}
+
+__attribute__((target("avx2")))
+inline unsigned load8_avx2(const double *z, __m256d &v0, __m256d &v1) {
+  v0 = _mm256_loadu_pd(z);
+  v1 = _mm256_loadu_pd(z + 4);
+  return finite_mask_avx2(v0, v1);
+}
+
+__attribute__((target("avx2")))
+inline unsigned load8_avx2(const float *z, __m256d &v0, __m256d &v1) {
+  __m256 f = _mm256_loadu_ps(z);
+  v0 = _mm256_cvtps_pd(_mm256_castps256_ps128(f));
+  v1 = _mm256_cvtps_pd(_mm256_extractf128_ps(f, 1));
+  return finite_mask_avx2(v0, v1);
+}
+
+__attribute__((target("avx2")))
+inline unsigned load8_avx2(const int32_t *z, __m256d &v0, __m256d &v1) {
+  __m256i v = _mm256_loadu_si256((const __m256i *)z);
+  v0 = _mm256_cvtepi32_pd(_mm256_castsi256_si128(v));
+  v1 = _mm256_cvtepi32_pd(_mm256_extracti128_si256(v, 1));
+  __m256i na = _mm256_cmpeq_epi32(v, _mm256_set1_epi32(INT32_MIN));
+  return ~_mm256_movemask_ps(_mm256_castsi256_ps(na)) & 0xff;
+}
+
+__attribute__((target("avx2")))
+inline unsigned load8_avx2(const int16_t *z, __m256d &v0, __m256d &v1) {
+  __m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)z));
+  v0 = _mm256_cvtepi32_pd(_mm256_castsi256_si128(v));
+  v1 = _mm256_cvtepi32_pd(_mm256_extracti128_si256(v, 1));
+  return 0xff;
+}
+
+template <class T>
+__attribute__((target("avx2")))
+void classify_points_avx2(const T *z, int n, double vlo, double vhi, unsigned char *out) {
+  const __m256d lo = _mm256_set1_pd(vlo), hi = _mm256_set1_pd(vhi);
+
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256d v0, v1;
+    unsigned m_finite = load8_avx2(z + i, v0, v1);
+    unsigned m_lo = _mm256_movemask_pd(_mm256_cmp_pd(v0, lo, _CMP_GE_OQ)) |
+      (_mm256_movemask_pd(_mm256_cmp_pd(v1, lo, _CMP_GE_OQ)) << 4);
+    unsigned m_hi = _mm256_movemask_pd(_mm256_cmp_pd(v0, hi, _CMP_GE_OQ)) |
+      (_mm256_movemask_pd(_mm256_cmp_pd(v1, hi, _CMP_GE_OQ)) << 4);
+    uint64_t t = pack_classes(m_lo, m_hi, m_finite);
+    memcpy(out + i, &t, 8);
+  }
+  classify_points_scalar(z + i, n - i, vlo, vhi, out + i);
+}
+
+__attribute__((target("avx2")))
+inline __m256i times_base_avx2(__m256i v, int base) {
+  __m256i v2 = _mm256_add_epi8(v, v);
+  return base == 3 ? _mm256_add_epi8(v2, v) : v2;
+}
+
+template <int base>
+__attribute__((target("avx2")))
+void combine_cells_avx2(const unsigned char *left, const unsigned char *right, int n, unsigned char *cells) {
+  const __m256i na = _mm256_set1_epi8((char)class_na), zero = _mm256_setzero_si256();
+
+  int r = 0;
+  for (; r + 32 <= n; r += 32) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(left + r));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(right + r));
+    __m256i c = _mm256_loadu_si256((const __m256i *)(right + r + 1));
+    __m256i d = _mm256_loadu_si256((const __m256i *)(left + r + 1));
+
+    __m256i any_na = _mm256_and_si256(_mm256_or_si256(_mm256_or_si256(a, b), _mm256_or_si256(c, d)), na);
+    __m256i code = _mm256_add_epi8(times_base_avx2(a, base), b);
+    code = _mm256_add_epi8(times_base_avx2(code, base), c);
+    code = _mm256_add_epi8(times_base_avx2(code, base), d);
+    code = _mm256_and_si256(code, _mm256_cmpeq_epi8(any_na, zero));
+    _mm256_storeu_si256((__m256i *)(cells + r), code);
+  }
+  combine_cells_sse2<base>(left + r, right + r, n - r, cells + r);
+}
+
+#endif // CLASSIFY_X86
+
+// the kernels used on this machine, chosen once on first use; there are no
+// SSE2 versions for grids of floats and integers, which are rare on machines
+// without AVX2
+struct kernels {
+  void (*classify_double)(const double *, int, double, double, unsigned char *);
+  void (*classify_float)(const float *, int, double, double, unsigned char *);
+  void (*classify_int32)(const int32_t *, int, double, double, unsigned char *);
+  void (*classify_int16)(const int16_t *, int, double, double, unsigned char *);
+  void (*combine2)(const unsigned char *, const unsigned char *, int, unsigned char *);
+  void (*combine3)(const unsigned char *, const unsigned char *, int, unsigned char *);
+
+  kernels() :
+    classify_double(classify_points_scalar<double>), classify_float(classify_points_scalar<float>),
+    classify_int32(classify_points_scalar<int32_t>), classify_int16(classify_points_scalar<int16_t>),
+    combine2(combine_cells_scalar<2>), combine3(combine_cells_scalar<3>)
+  {
+#ifdef CLASSIFY_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      classify_double = classify_points_avx2<double>;
+      classify_float = classify_points_avx2<float>;
+      classify_int32 = classify_points_avx2<int32_t>;
+      classify_int16 = classify_points_avx2<int16_t>;
+      combine2 = combine_cells_avx2<2>;
+      combine3 = combine_cells_avx2<3>;
+    } else if (__builtin_cpu_supports("sse2")) {
+      classify_double = classify_points_sse2;
+      combine2 = combine_cells_sse2<2>;
+      combine3 = combine_cells_sse2<3>;
+    }
+#endif
+  }
+};
+
+const kernels &cpu_kernels() {
+  static const kernels k;
+  return k;
+}
+
+} // namespace
+
+void classify_points(const double *z, int n, double vlo, double vhi, unsigned char *out) {
+  cpu_kernels().classify_double(z, n, vlo, vhi, out);
+}
+
+void classify_points(const float *z, int n, double vlo, double vhi, unsigned char *out) {
+  cpu_kernels().classify_float(z, n, vlo, vhi, out);
+}
+
+void classify_points(const int32_t *z, int n, double vlo, double vhi, unsigned char *out) {
+  cpu_kernels().classify_int32(z, n, vlo, vhi, out);
+}
+
+void classify_points(const int16_t *z, int n, double vlo, double vhi, unsigned char *out) {
+  cpu_kernels().classify_int16(z, n, vlo, vhi, out);
+}
+
+void combine_cells(const unsigned char *left, const unsigned char *right, int n, int base, unsigned char *cells) {
+  if (base == 3) {
+    cpu_kernels().combine3(left, right, n, cells);
+  } else {
+    cpu_kernels().combine2(left, right, n, cells);
+  }
+}
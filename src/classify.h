@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+
+// Classification of grid values and cells relative to contour levels. This
+// is the part of the algorithm that touches every grid point for every level,
+// so it comes in vectorized versions. The fastest version supported by the
+// CPU is chosen at runtime: AVX2 or SSE2 on x86 processors, plain C++
+// everywhere else.
+
+// class of grid values that are NA, NaN, or infinite
+const unsigned char class_na = 0x80;
+
+// classifies the n values in z as 0 (below vlo), 1 (at or above vlo and below
+// vhi), 2 (at or above vhi), or class_na (not finite). With vhi = +Inf, this
+// is the binary classification needed for isolines. Grids can hold doubles,
+// floats, 32-bit integers (where R's NA, the smallest int, is class_na), or
+// 16-bit integers; values are compared as doubles, so the classes are the
+// same as for the grid converted to double.
+void classify_points(const double *z, int n, double vlo, double vhi, unsigned char *out);
+void classify_points(const float *z, int n, double vlo, double vhi, unsigned char *out);
+void classify_points(const int32_t *z, int n, double vlo, double vhi, unsigned char *out);
+void classify_points(const int16_t *z, int n, double vlo, double vhi, unsigned char *out);
+
+// combines the classes of the grid points of two neighboring columns into the
+// codes of the n cells between them. Cell r has corners left[r], right[r],
+// right[r+1], left[r+1], which are the digits of its code in the given base
+// (3 for isobands, 2 for isolines). Cells with a non-finite corner get code 0.
+void combine_cells(const unsigned char *left, const unsigned char *right, int n, int base, unsigned char *cells);
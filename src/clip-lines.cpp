@@ -3,8 +3,10 @@
 #include "cpp11/list.hpp"
 #define R_NO_REMAP
 
+#include <algorithm>
 #include <cmath>
 #include <cstddef>  // for size_t
+#include <vector>
 using namespace std;
 
 #include "clip-lines.h"
@@ -247,9 +249,35 @@ bool in_unit_box(const point &p) {
   return false;
 }
 
+// clipped lines, collected in plain vectors and copied into R at the end
+struct line_buffer {
+  vector<double> x, y;
+  vector<int> id;
+
+  void clear() {
+    x.clear();
+    y.clear();
+    id.clear();
+  }
+
+  cpp11::writable::list as_list() const {
+    R_xlen_t n = x.size();
+    cpp11::writable::doubles x_out(n), y_out(n);
+    cpp11::writable::integers id_out(n);
+    copy(x.begin(), x.end(), REAL(x_out));
+    copy(y.begin(), y.end(), REAL(y_out));
+    copy(id.begin(), id.end(), INTEGER(id_out));
+
+    return cpp11::writable::list({
+      "x"_nm = x_out,
+      "y"_nm = y_out,
+      "id"_nm = id_out
+    });
+  }
+};
+
 // helper function for crop_lines()
-void record_points(cpp11::writable::doubles &x_out, cpp11::writable::doubles &y_out, cpp11::writable::integers &id_out,
-                   const point &p1, const point &p2, int &cur_id_out,
+void record_points(line_buffer &out, const point &p1, const point &p2, int &cur_id_out,
                    bool &p1_recorded, bool &p2_recorded, bool &new_line_segment) {
   if (new_line_segment) {
     // start a new line segment, but defer if nothing to record
@@ -260,83 +288,24 @@ void record_points(cpp11::writable::doubles &x_out, cpp11::writable::doubles &y_
   }
 
   if (!p1_recorded) {
-    x_out.push_back(p1.x);
-    y_out.push_back(p1.y);
-    id_out.push_back(cur_id_out);
+    out.x.push_back(p1.x);
+    out.y.push_back(p1.y);
+    out.id.push_back(cur_id_out);
     p1_recorded = true;
   }
 
   if (!p2_recorded) {
-    x_out.push_back(p2.x);
-    y_out.push_back(p2.y);
-    id_out.push_back(cur_id_out);
+    out.x.push_back(p2.x);
+    out.y.push_back(p2.y);
+    out.id.push_back(cur_id_out);
     p2_recorded = true;
   }
 }
 
-
-// Clip lines to the outside of a box
-//
-// Clip lines to the outside of a box. The box is specified via midpoint, width,
-// height, and a rotation angle in radians. This is used to create space within
-// isolines for text labels or other annotations.
-//
-// @param x Numeric vector of x coordinates
-// @param y Numeric vector of y coordinates
-// @param id Integer vector of id numbers indicating which lines are connected
-// @param p_mid_x,p_mid_y Numeric values specifying the x and y position of the box midpoint
-// @param width Box width
-// @param height Box height
-// @param theta Box angle, in radians
-// @param asp Aspect ratio (width/height) of the target canvas. This is used to convert widths
-//  to heights and vice versa for rotated boxes
-// @export
-[[cpp11::register]]
-cpp11::writable::list clip_lines_impl(
-  cpp11::doubles x,
-  cpp11::doubles y,
-  cpp11::integers id,
-  double p_mid_x,
-  double p_mid_y,
-  double width,
-  double height,
-  double theta,
-  double asp
-) {
-  // input
-  int n = x.size();
-  double* x_p = REAL(x);
-  double* y_p = REAL(y);
-  int* id_p = INTEGER(id);
-
-  // output variable
-  //SEXP res = PROTECT(Rf_allocVector(VECSXP, 3));
-  //SEXP names = PROTECT(Rf_allocVector(STRSXP, 3));
-  //SET_STRING_ELT(names, 0, Rf_mkChar("x"));
-  //SET_STRING_ELT(names, 1, Rf_mkChar("y"));
-  //SET_STRING_ELT(names, 2, Rf_mkChar("id"));
-  //Rf_setAttrib(res, Rf_install("names"), names);
-
-  cpp11::writable::doubles x_out, y_out;
-  cpp11::writable::integers id_out;
-
-  // input checks
-  if (n != y.size()) {
-    cpp11::stop("Number of x and y coordinates must match.");
-  }
-  if (n != id.size()) {
-    cpp11::stop("Number of x coordinates and id values must match.");
-  }
-  if (n == 0) {
-    // empty input, return empty output
-    return cpp11::writable::list({
-      "x"_nm = x_out,
-      "y"_nm = y_out,
-      "id"_nm = id_out
-    });
-  }
-
-  // set up transformation
+// sets up the transformation into the coordinate system of a box, specified via
+// midpoint, width, height, and a rotation angle in radians
+unitbox_transformer box_transformer(double p_mid_x, double p_mid_y, double width, double height,
+                                    double theta, double asp) {
   // lower left point of cropping rectangle
   point ll(p_mid_x - width*cos(theta)/2 + (height/asp)*sin(theta)/2,
            p_mid_y - asp*width*sin(theta)/2 - height*cos(theta)/2);
@@ -345,9 +314,14 @@ cpp11::writable::list clip_lines_impl(
   // upper left point
   point ul(ll.x - (height/asp)*sin(theta), ll.y + height*cos(theta));
 
-  unitbox_transformer t(ll, lr, ul);
+  return unitbox_transformer(ll, lr, ul);
+}
 
-  // crop
+// clips the n > 0 points of the lines x, y, id to the outside of the box of
+// transformer t and appends the resulting lines to out, with ids counting up
+// from 1
+void clip_to_box(const double *x_p, const double *y_p, const int *id_p, R_xlen_t n,
+                 unitbox_transformer &t, line_buffer &out) {
   int cur_id = id_p[0];
   int cur_id_out = 0; // first output id - 1
   point p1, p2, p1t, p2t;
@@ -359,13 +333,13 @@ cpp11::writable::list clip_lines_impl(
   bool p2_recorded = true; // when we first enter the loop, have only p1 unrecorded
   bool new_line_segment = true;
 
-  int i = 1;
+  R_xlen_t i = 1;
   while(i < n) {
     if (cur_id != id_p[i]) {
       // id mismatch means we are starting a new line segment
 
       // first record any points that haven't been recorded yet. catches singlets
-      record_points(x_out, y_out, id_out, p1, p2, cur_id_out,
+      record_points(out, p1, p2, cur_id_out,
                     p1_recorded, p2_recorded, new_line_segment);
       // now set up next line segment
       p1 = point(x_p[i], y_p[i]);
@@ -396,13 +370,13 @@ cpp11::writable::list clip_lines_impl(
       break;
     case at_end:
       p2_recorded = false;
-      record_points(x_out, y_out, id_out, p1, t.inv_transform(crop1), cur_id_out,
+      record_points(out, p1, t.inv_transform(crop1), cur_id_out,
                     p1_recorded, p2_recorded, new_line_segment);
       new_line_segment = true;
       break;
     case in_middle:
       p2_recorded = false;
-      record_points(x_out, y_out, id_out, p1, t.inv_transform(crop1), cur_id_out,
+      record_points(out, p1, t.inv_transform(crop1), cur_id_out,
                     p1_recorded, p2_recorded, new_line_segment);
       p1t = crop2;
       p1 = t.inv_transform(p1t);
@@ -414,21 +388,216 @@ cpp11::writable::list clip_lines_impl(
       break;
     }
 
-    record_points(x_out, y_out, id_out, p1, p2, cur_id_out,
+    record_points(out, p1, p2, cur_id_out,
                   p1_recorded, p2_recorded, new_line_segment);
     p1 = p2;
     p1t = p2t;
     i++;
   }
   // record any remaining points; catches singlets
-  record_points(x_out, y_out, id_out, p1, p2, cur_id_out,
+  record_points(out, p1, p2, cur_id_out,
                 p1_recorded, p2_recorded, new_line_segment);
+}
+
+
+// Clip lines to the outside of a box
+//
+// Clip lines to the outside of a box. The box is specified via midpoint, width,
+// height, and a rotation angle in radians. This is used to create space within
+// isolines for text labels or other annotations.
+//
+// @param x Numeric vector of x coordinates
+// @param y Numeric vector of y coordinates
+// @param id Integer vector of id numbers indicating which lines are connected
+// @param p_mid_x,p_mid_y Numeric values specifying the x and y position of the box midpoint
+// @param width Box width
+// @param height Box height
+// @param theta Box angle, in radians
+// @param asp Aspect ratio (width/height) of the target canvas. This is used to convert widths
+//  to heights and vice versa for rotated boxes
+// @export
+[[cpp11::register]]
+cpp11::writable::list clip_lines_impl(
+  cpp11::doubles x,
+  cpp11::doubles y,
+  cpp11::integers id,
+  double p_mid_x,
+  double p_mid_y,
+  double width,
+  double height,
+  double theta,
+  double asp
+) {
+  // input
+  int n = x.size();
+  line_buffer out;
+
+  // input checks
+  if (n != y.size()) {
+    cpp11::stop("Number of x and y coordinates must match.");
+  }
+  if (n != id.size()) {
+    cpp11::stop("Number of x coordinates and id values must match.");
+  }
+  if (n == 0) {
+    // empty input, return empty output
+    return out.as_list();
+  }
+
+  unitbox_transformer t = box_transformer(p_mid_x, p_mid_y, width, height, theta, asp);
+  clip_to_box(REAL(x), REAL(y), INTEGER(id), n, t, out);
+
+  return out.as_list();
+}
+
+// Clip lines to the outside of a set of boxes
+//
+// Gives the same result as clipping the lines to each of the boxes in turn with
+// clip_lines_impl(), but in a single pass over the lines. The bounding boxes of
+// the boxes are indexed in a uniform grid, and each line is only clipped to the
+// boxes whose bounding boxes overlap its own; the others leave it unchanged.
+//
+// @param p_mid_x,p_mid_y,width,height,theta Numeric vectors specifying the boxes,
+//  as for clip_lines_impl()
+[[cpp11::register]]
+cpp11::writable::list clip_lines_boxes_impl(
+  cpp11::doubles x,
+  cpp11::doubles y,
+  cpp11::integers id,
+  cpp11::doubles p_mid_x,
+  cpp11::doubles p_mid_y,
+  cpp11::doubles width,
+  cpp11::doubles height,
+  cpp11::doubles theta,
+  double asp
+) {
+  R_xlen_t n = x.size();
+  int n_boxes = p_mid_x.size();
+  line_buffer out;
+
+  // input checks
+  if (n != y.size()) {
+    cpp11::stop("Number of x and y coordinates must match.");
+  }
+  if (n != id.size()) {
+    cpp11::stop("Number of x coordinates and id values must match.");
+  }
+  if (p_mid_y.size() != n_boxes || width.size() != n_boxes || height.size() != n_boxes ||
+      theta.size() != n_boxes) {
+    cpp11::stop("All box parameters must have the same length.");
+  }
+  if (n == 0) {
+    return out.as_list();
+  }
+
+  // transformations and bounding boxes of the boxes
+  vector<unitbox_transformer> transformers;
+  vector<double> bx0(n_boxes), bx1(n_boxes), by0(n_boxes), by1(n_boxes);
+  for (int k = 0; k < n_boxes; k++) {
+    transformers.push_back(box_transformer(p_mid_x[k], p_mid_y[k], width[k], height[k], theta[k], asp));
+    point corners[4] = {point(0, 0), point(1, 0), point(0, 1), point(1, 1)};
+    for (int c = 0; c < 4; c++) {
+      point p = transformers[k].inv_transform(corners[c]);
+      bx0[k] = (c == 0) ? p.x : min(bx0[k], p.x);
+      bx1[k] = (c == 0) ? p.x : max(bx1[k], p.x);
+      by0[k] = (c == 0) ? p.y : min(by0[k], p.y);
+      by1[k] = (c == 0) ? p.y : max(by1[k], p.y);
+    }
+  }
+
+  // uniform grid of about n_boxes cells over the bounding boxes, listing the
+  // boxes that overlap each cell in their original order; boxes with missing
+  // parameters clip nothing
+  double gx0 = INFINITY, gx1 = -INFINITY, gy0 = INFINITY, gy1 = -INFINITY;
+  vector<bool> valid(n_boxes);
+  for (int k = 0; k < n_boxes; k++) {
+    valid[k] = isfinite(bx0[k]) && isfinite(bx1[k]) && isfinite(by0[k]) && isfinite(by1[k]);
+    if (!valid[k]) continue;
+    gx0 = min(gx0, bx0[k]);
+    gx1 = max(gx1, bx1[k]);
+    gy0 = min(gy0, by0[k]);
+    gy1 = max(gy1, by1[k]);
+  }
+  int n_cells = max(1, (int)ceil(sqrt((double)n_boxes)));
+  double cell_w = (gx1 > gx0) ? (gx1 - gx0) / n_cells : 1;
+  double cell_h = (gy1 > gy0) ? (gy1 - gy0) / n_cells : 1;
+  // clamped before the conversion to int, which is undefined for values out of range
+  auto cell_x = [&](double v) {return (int)max(0.0, min(floor((v - gx0) / cell_w), n_cells - 1.0));};
+  auto cell_y = [&](double v) {return (int)max(0.0, min(floor((v - gy0) / cell_h), n_cells - 1.0));};
+
+  vector<vector<int>> cells(n_cells * n_cells);
+  for (int k = 0; k < n_boxes; k++) {
+    if (!valid[k]) continue;
+    for (int r = cell_y(by0[k]); r <= cell_y(by1[k]); r++) {
+      for (int c = cell_x(bx0[k]); c <= cell_x(bx1[k]); c++) {
+        cells[r * n_cells + c].push_back(k);
+      }
+    }
+  }
+
+  const double *x_p = REAL(x), *y_p = REAL(y);
+  const int *id_p = INTEGER(id);
+  vector<int> candidates;
+  vector<R_xlen_t> seen(n_boxes, -1); // the line a box was last considered for
+  line_buffer current, next;
+  int cur_id_out = 0;
+  R_xlen_t start = 0;
+  while (start < n) {
+    R_xlen_t end = start + 1;
+    double lx0 = x_p[start], lx1 = x_p[start], ly0 = y_p[start], ly1 = y_p[start];
+    for (; end < n && id_p[end] == id_p[start]; end++) {
+      lx0 = min(lx0, x_p[end]);
+      lx1 = max(lx1, x_p[end]);
+      ly0 = min(ly0, y_p[end]);
+      ly1 = max(ly1, y_p[end]);
+    }
+
+    // the boxes that can touch this line
+    candidates.clear();
+    if (lx1 >= gx0 && lx0 <= gx1 && ly1 >= gy0 && ly0 <= gy1) {
+      for (int r = cell_y(ly0); r <= cell_y(ly1); r++) {
+        for (int c = cell_x(lx0); c <= cell_x(lx1); c++) {
+          const vector<int> &cell = cells[r * n_cells + c];
+          for (auto it = cell.begin(); it != cell.end(); it++) {
+            int k = *it;
+            if (seen[k] == start) continue;
+            seen[k] = start;
+            if (bx1[k] >= lx0 && bx0[k] <= lx1 && by1[k] >= ly0 && by0[k] <= ly1) {
+              candidates.push_back(k);
+            }
+          }
+        }
+      }
+      sort(candidates.begin(), candidates.end());
+    }
+
+    // clip the line to each candidate box in turn
+    current.clear();
+    if (candidates.empty()) {
+      current.x.assign(x_p + start, x_p + end);
+      current.y.assign(y_p + start, y_p + end);
+      current.id.assign(end - start, 0);
+    } else {
+      clip_to_box(x_p + start, y_p + start, id_p + start, end - start, transformers[candidates[0]], current);
+      for (auto it = candidates.begin() + 1; it != candidates.end() && !current.x.empty(); it++) {
+        next.clear();
+        clip_to_box(current.x.data(), current.y.data(), current.id.data(), current.x.size(),
+                    transformers[*it], next);
+        swap(current, next);
+      }
+    }
+
+    // renumber the pieces so ids count up across all lines
+    for (size_t i = 0; i < current.x.size(); i++) {
+      if (i == 0 || current.id[i] != current.id[i-1]) cur_id_out++;
+      out.x.push_back(current.x[i]);
+      out.y.push_back(current.y[i]);
+      out.id.push_back(cur_id_out);
+    }
+    start = end;
+  }
 
-  return cpp11::writable::list({
-    "x"_nm = x_out,
-    "y"_nm = y_out,
-    "id"_nm = id_out
-  });
+  return out.as_list();
 }
 
 
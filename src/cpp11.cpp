@@ -12,18 +12,145 @@ extern "C" SEXP _isoband_clip_lines_impl(SEXP x, SEXP y, SEXP id, SEXP p_mid_x,
     return cpp11::as_sexp(clip_lines_impl(cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(x), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(y), cpp11::as_cpp<cpp11::decay_t<cpp11::integers>>(id), cpp11::as_cpp<cpp11::decay_t<double>>(p_mid_x), cpp11::as_cpp<cpp11::decay_t<double>>(p_mid_y), cpp11::as_cpp<cpp11::decay_t<double>>(width), cpp11::as_cpp<cpp11::decay_t<double>>(height), cpp11::as_cpp<cpp11::decay_t<double>>(theta), cpp11::as_cpp<cpp11::decay_t<double>>(asp)));
   END_CPP11
 }
+// clip-lines.cpp
+cpp11::writable::list clip_lines_boxes_impl(cpp11::doubles x, cpp11::doubles y, cpp11::integers id, cpp11::doubles p_mid_x, cpp11::doubles p_mid_y, cpp11::doubles width, cpp11::doubles height, cpp11::doubles theta, double asp);
+extern "C" SEXP _isoband_clip_lines_boxes_impl(SEXP x, SEXP y, SEXP id, SEXP p_mid_x, SEXP p_mid_y, SEXP width, SEXP height, SEXP theta, SEXP asp) {
+  BEGIN_CPP11
+    return cpp11::as_sexp(clip_lines_boxes_impl(cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(x), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(y), cpp11::as_cpp<cpp11::decay_t<cpp11::integers>>(id), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(p_mid_x), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(p_mid_y), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(width), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(height), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(theta), cpp11::as_cpp<cpp11::decay_t<double>>(asp)));
+  END_CPP11
+}
+// isoband.cpp
+cpp11::writable::list isobands_impl(cpp11::doubles x, cpp11::doubles y, cpp11::sexp z, cpp11::doubles value_low, cpp11::doubles value_high, int threads, double min_area, int min_vertices, bool metrics, bool parent);
+extern "C" SEXP _isoband_isobands_impl(SEXP x, SEXP y, SEXP z, SEXP value_low, SEXP value_high, SEXP threads, SEXP min_area, SEXP min_vertices, SEXP metrics, SEXP parent) {
+  BEGIN_CPP11
+    return cpp11::as_sexp(isobands_impl(cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(x), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(y), cpp11::as_cpp<cpp11::decay_t<cpp11::sexp>>(z), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(value_low), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(value_high), cpp11::as_cpp<cpp11::decay_t<int>>(threads), cpp11::as_cpp<cpp11::decay_t<double>>(min_area), cpp11::as_cpp<cpp11::decay_t<int>>(min_vertices), cpp11::as_cpp<cpp11::decay_t<bool>>(metrics), cpp11::as_cpp<cpp11::decay_t<bool>>(parent)));
+  END_CPP11
+}
 // isoband.cpp
-cpp11::writable::list isobands_impl(cpp11::doubles x, cpp11::doubles y, cpp11::doubles_matrix<> z, cpp11::doubles value_low, cpp11::doubles value_high);
-extern "C" SEXP _isoband_isobands_impl(SEXP x, SEXP y, SEXP z, SEXP value_low, SEXP value_high) {
+cpp11::writable::list isolines_impl(cpp11::doubles x, cpp11::doubles y, cpp11::sexp z, cpp11::doubles value, int threads, double min_area, int min_vertices, bool metrics);
+extern "C" SEXP _isoband_isolines_impl(SEXP x, SEXP y, SEXP z, SEXP value, SEXP threads, SEXP min_area, SEXP min_vertices, SEXP metrics) {
   BEGIN_CPP11
-    return cpp11::as_sexp(isobands_impl(cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(x), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(y), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles_matrix<>>>(z), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(value_low), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(value_high)));
+    return cpp11::as_sexp(isolines_impl(cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(x), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(y), cpp11::as_cpp<cpp11::decay_t<cpp11::sexp>>(z), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(value), cpp11::as_cpp<cpp11::decay_t<int>>(threads), cpp11::as_cpp<cpp11::decay_t<double>>(min_area), cpp11::as_cpp<cpp11::decay_t<int>>(min_vertices), cpp11::as_cpp<cpp11::decay_t<bool>>(metrics)));
   END_CPP11
 }
 // isoband.cpp
-cpp11::writable::list isolines_impl(cpp11::doubles x, cpp11::doubles y, cpp11::doubles_matrix<> z, cpp11::doubles value);
-extern "C" SEXP _isoband_isolines_impl(SEXP x, SEXP y, SEXP z, SEXP value) {
+cpp11::writable::list isobands_stats_impl(cpp11::doubles x, cpp11::doubles y, cpp11::sexp z, cpp11::doubles value_low, cpp11::doubles value_high, int threads);
+extern "C" SEXP _isoband_isobands_stats_impl(SEXP x, SEXP y, SEXP z, SEXP value_low, SEXP value_high, SEXP threads) {
   BEGIN_CPP11
-    return cpp11::as_sexp(isolines_impl(cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(x), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(y), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles_matrix<>>>(z), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(value)));
+    return cpp11::as_sexp(isobands_stats_impl(cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(x), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(y), cpp11::as_cpp<cpp11::decay_t<cpp11::sexp>>(z), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(value_low), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(value_high), cpp11::as_cpp<cpp11::decay_t<int>>(threads)));
+  END_CPP11
+}
+// isoband.cpp
+cpp11::writable::list isolines_stats_impl(cpp11::doubles x, cpp11::doubles y, cpp11::sexp z, cpp11::doubles value, int threads);
+extern "C" SEXP _isoband_isolines_stats_impl(SEXP x, SEXP y, SEXP z, SEXP value, SEXP threads) {
+  BEGIN_CPP11
+    return cpp11::as_sexp(isolines_stats_impl(cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(x), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(y), cpp11::as_cpp<cpp11::decay_t<cpp11::sexp>>(z), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(value), cpp11::as_cpp<cpp11::decay_t<int>>(threads)));
+  END_CPP11
+}
+// isoband.cpp
+SEXP iso_grid_impl(cpp11::doubles x, cpp11::doubles y, cpp11::sexp z);
+extern "C" SEXP _isoband_iso_grid_impl(SEXP x, SEXP y, SEXP z) {
+  BEGIN_CPP11
+    return cpp11::as_sexp(iso_grid_impl(cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(x), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(y), cpp11::as_cpp<cpp11::decay_t<cpp11::sexp>>(z)));
+  END_CPP11
+}
+// isoband.cpp
+void iso_grid_update_impl(cpp11::sexp grid, int row0, int col0, cpp11::sexp values);
+extern "C" SEXP _isoband_iso_grid_update_impl(SEXP grid, SEXP row0, SEXP col0, SEXP values) {
+  BEGIN_CPP11
+    iso_grid_update_impl(cpp11::as_cpp<cpp11::decay_t<cpp11::sexp>>(grid), cpp11::as_cpp<cpp11::decay_t<int>>(row0), cpp11::as_cpp<cpp11::decay_t<int>>(col0), cpp11::as_cpp<cpp11::decay_t<cpp11::sexp>>(values));
+    return R_NilValue;
+  END_CPP11
+}
+// isoband.cpp
+cpp11::writable::list isobands_grid_impl(cpp11::sexp grid, cpp11::doubles value_low, cpp11::doubles value_high, int threads, double min_area, int min_vertices, bool metrics, bool parent);
+extern "C" SEXP _isoband_isobands_grid_impl(SEXP grid, SEXP value_low, SEXP value_high, SEXP threads, SEXP min_area, SEXP min_vertices, SEXP metrics, SEXP parent) {
+  BEGIN_CPP11
+    return cpp11::as_sexp(isobands_grid_impl(cpp11::as_cpp<cpp11::decay_t<cpp11::sexp>>(grid), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(value_low), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(value_high), cpp11::as_cpp<cpp11::decay_t<int>>(threads), cpp11::as_cpp<cpp11::decay_t<double>>(min_area), cpp11::as_cpp<cpp11::decay_t<int>>(min_vertices), cpp11::as_cpp<cpp11::decay_t<bool>>(metrics), cpp11::as_cpp<cpp11::decay_t<bool>>(parent)));
+  END_CPP11
+}
+// isoband.cpp
+cpp11::writable::list isolines_grid_impl(cpp11::sexp grid, cpp11::doubles value, int threads, double min_area, int min_vertices, bool metrics);
+extern "C" SEXP _isoband_isolines_grid_impl(SEXP grid, SEXP value, SEXP threads, SEXP min_area, SEXP min_vertices, SEXP metrics) {
+  BEGIN_CPP11
+    return cpp11::as_sexp(isolines_grid_impl(cpp11::as_cpp<cpp11::decay_t<cpp11::sexp>>(grid), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(value), cpp11::as_cpp<cpp11::decay_t<int>>(threads), cpp11::as_cpp<cpp11::decay_t<double>>(min_area), cpp11::as_cpp<cpp11::decay_t<int>>(min_vertices), cpp11::as_cpp<cpp11::decay_t<bool>>(metrics)));
+  END_CPP11
+}
+// isoband.cpp
+cpp11::writable::list isobands_stack_impl(cpp11::doubles x, cpp11::doubles y, cpp11::sexp z, cpp11::doubles value_low, cpp11::doubles value_high, int threads);
+extern "C" SEXP _isoband_isobands_stack_impl(SEXP x, SEXP y, SEXP z, SEXP value_low, SEXP value_high, SEXP threads) {
+  BEGIN_CPP11
+    return cpp11::as_sexp(isobands_stack_impl(cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(x), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(y), cpp11::as_cpp<cpp11::decay_t<cpp11::sexp>>(z), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(value_low), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(value_high), cpp11::as_cpp<cpp11::decay_t<int>>(threads)));
+  END_CPP11
+}
+// isoband.cpp
+cpp11::writable::list isolines_stack_impl(cpp11::doubles x, cpp11::doubles y, cpp11::sexp z, cpp11::doubles value, int threads);
+extern "C" SEXP _isoband_isolines_stack_impl(SEXP x, SEXP y, SEXP z, SEXP value, SEXP threads) {
+  BEGIN_CPP11
+    return cpp11::as_sexp(isolines_stack_impl(cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(x), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(y), cpp11::as_cpp<cpp11::decay_t<cpp11::sexp>>(z), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(value), cpp11::as_cpp<cpp11::decay_t<int>>(threads)));
+  END_CPP11
+}
+// isoband.cpp
+cpp11::writable::list isobands_batch_impl(cpp11::list x, cpp11::list y, cpp11::list z, cpp11::doubles value_low, cpp11::doubles value_high, int threads);
+extern "C" SEXP _isoband_isobands_batch_impl(SEXP x, SEXP y, SEXP z, SEXP value_low, SEXP value_high, SEXP threads) {
+  BEGIN_CPP11
+    return cpp11::as_sexp(isobands_batch_impl(cpp11::as_cpp<cpp11::decay_t<cpp11::list>>(x), cpp11::as_cpp<cpp11::decay_t<cpp11::list>>(y), cpp11::as_cpp<cpp11::decay_t<cpp11::list>>(z), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(value_low), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(value_high), cpp11::as_cpp<cpp11::decay_t<int>>(threads)));
+  END_CPP11
+}
+// isoband.cpp
+cpp11::writable::list isolines_batch_impl(cpp11::list x, cpp11::list y, cpp11::list z, cpp11::doubles value, int threads);
+extern "C" SEXP _isoband_isolines_batch_impl(SEXP x, SEXP y, SEXP z, SEXP value, SEXP threads) {
+  BEGIN_CPP11
+    return cpp11::as_sexp(isolines_batch_impl(cpp11::as_cpp<cpp11::decay_t<cpp11::list>>(x), cpp11::as_cpp<cpp11::decay_t<cpp11::list>>(y), cpp11::as_cpp<cpp11::decay_t<cpp11::list>>(z), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(value), cpp11::as_cpp<cpp11::decay_t<int>>(threads)));
+  END_CPP11
+}
+// isoband.cpp
+cpp11::writable::list isobands_stream_impl(cpp11::doubles x, cpp11::doubles y, cpp11::function read_rows, cpp11::doubles value_low, cpp11::doubles value_high, int block_rows);
+extern "C" SEXP _isoband_isobands_stream_impl(SEXP x, SEXP y, SEXP read_rows, SEXP value_low, SEXP value_high, SEXP block_rows) {
+  BEGIN_CPP11
+    return cpp11::as_sexp(isobands_stream_impl(cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(x), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(y), cpp11::as_cpp<cpp11::decay_t<cpp11::function>>(read_rows), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(value_low), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(value_high), cpp11::as_cpp<cpp11::decay_t<int>>(block_rows)));
+  END_CPP11
+}
+// isoband.cpp
+cpp11::writable::list isolines_stream_impl(cpp11::doubles x, cpp11::doubles y, cpp11::function read_rows, cpp11::doubles value, int block_rows);
+extern "C" SEXP _isoband_isolines_stream_impl(SEXP x, SEXP y, SEXP read_rows, SEXP value, SEXP block_rows) {
+  BEGIN_CPP11
+    return cpp11::as_sexp(isolines_stream_impl(cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(x), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(y), cpp11::as_cpp<cpp11::decay_t<cpp11::function>>(read_rows), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(value), cpp11::as_cpp<cpp11::decay_t<int>>(block_rows)));
+  END_CPP11
+}
+// isoband.cpp
+cpp11::writable::list isobands_file_impl(cpp11::doubles x, cpp11::doubles y, std::string path, bool integer, int size, bool big_endian, bool byrow, cpp11::doubles value_low, cpp11::doubles value_high, int block_rows);
+extern "C" SEXP _isoband_isobands_file_impl(SEXP x, SEXP y, SEXP path, SEXP integer, SEXP size, SEXP big_endian, SEXP byrow, SEXP value_low, SEXP value_high, SEXP block_rows) {
+  BEGIN_CPP11
+    return cpp11::as_sexp(isobands_file_impl(cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(x), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(y), cpp11::as_cpp<cpp11::decay_t<std::string>>(path), cpp11::as_cpp<cpp11::decay_t<bool>>(integer), cpp11::as_cpp<cpp11::decay_t<int>>(size), cpp11::as_cpp<cpp11::decay_t<bool>>(big_endian), cpp11::as_cpp<cpp11::decay_t<bool>>(byrow), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(value_low), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(value_high), cpp11::as_cpp<cpp11::decay_t<int>>(block_rows)));
+  END_CPP11
+}
+// isoband.cpp
+cpp11::writable::list isolines_file_impl(cpp11::doubles x, cpp11::doubles y, std::string path, bool integer, int size, bool big_endian, bool byrow, cpp11::doubles value, int block_rows);
+extern "C" SEXP _isoband_isolines_file_impl(SEXP x, SEXP y, SEXP path, SEXP integer, SEXP size, SEXP big_endian, SEXP byrow, SEXP value, SEXP block_rows) {
+  BEGIN_CPP11
+    return cpp11::as_sexp(isolines_file_impl(cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(x), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(y), cpp11::as_cpp<cpp11::decay_t<std::string>>(path), cpp11::as_cpp<cpp11::decay_t<bool>>(integer), cpp11::as_cpp<cpp11::decay_t<int>>(size), cpp11::as_cpp<cpp11::decay_t<bool>>(big_endian), cpp11::as_cpp<cpp11::decay_t<bool>>(byrow), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(value), cpp11::as_cpp<cpp11::decay_t<int>>(block_rows)));
+  END_CPP11
+}
+// iso-locate.cpp
+SEXP iso_locator_impl(cpp11::list x, cpp11::list y, cpp11::list id);
+extern "C" SEXP _isoband_iso_locator_impl(SEXP x, SEXP y, SEXP id) {
+  BEGIN_CPP11
+    return cpp11::as_sexp(iso_locator_impl(cpp11::as_cpp<cpp11::decay_t<cpp11::list>>(x), cpp11::as_cpp<cpp11::decay_t<cpp11::list>>(y), cpp11::as_cpp<cpp11::decay_t<cpp11::list>>(id)));
+  END_CPP11
+}
+// iso-locate.cpp
+cpp11::writable::list iso_locate_impl(cpp11::sexp locator, cpp11::doubles x, cpp11::doubles y, int threads);
+extern "C" SEXP _isoband_iso_locate_impl(SEXP locator, SEXP x, SEXP y, SEXP threads) {
+  BEGIN_CPP11
+    return cpp11::as_sexp(iso_locate_impl(cpp11::as_cpp<cpp11::decay_t<cpp11::sexp>>(locator), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(x), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(y), cpp11::as_cpp<cpp11::decay_t<int>>(threads)));
+  END_CPP11
+}
+// iso-metrics.cpp
+cpp11::writable::list path_metrics_impl(cpp11::doubles x, cpp11::doubles y, cpp11::integers id, bool closed);
+extern "C" SEXP _isoband_path_metrics_impl(SEXP x, SEXP y, SEXP id, SEXP closed) {
+  BEGIN_CPP11
+    return cpp11::as_sexp(path_metrics_impl(cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(x), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(y), cpp11::as_cpp<cpp11::decay_t<cpp11::integers>>(id), cpp11::as_cpp<cpp11::decay_t<bool>>(closed)));
   END_CPP11
 }
 // separate-polygons.cpp
@@ -33,13 +160,39 @@ extern "C" SEXP _isoband_separate_polygons(SEXP x, SEXP y, SEXP id) {
     return cpp11::as_sexp(separate_polygons(cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(x), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(y), cpp11::as_cpp<cpp11::decay_t<cpp11::integers>>(id)));
   END_CPP11
 }
+// separate-polygons.cpp
+cpp11::sexp assemble_polygons(cpp11::doubles x, cpp11::doubles y, cpp11::integers id, cpp11::integers parent);
+extern "C" SEXP _isoband_assemble_polygons(SEXP x, SEXP y, SEXP id, SEXP parent) {
+  BEGIN_CPP11
+    return cpp11::as_sexp(assemble_polygons(cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(x), cpp11::as_cpp<cpp11::decay_t<cpp11::doubles>>(y), cpp11::as_cpp<cpp11::decay_t<cpp11::integers>>(id), cpp11::as_cpp<cpp11::decay_t<cpp11::integers>>(parent)));
+  END_CPP11
+}
 
 extern "C" {
 static const R_CallMethodDef CallEntries[] = {
-    {"_isoband_clip_lines_impl",   (DL_FUNC) &_isoband_clip_lines_impl,   9},
-    {"_isoband_isobands_impl",     (DL_FUNC) &_isoband_isobands_impl,     5},
-    {"_isoband_isolines_impl",     (DL_FUNC) &_isoband_isolines_impl,     4},
-    {"_isoband_separate_polygons", (DL_FUNC) &_isoband_separate_polygons, 3},
+    {"_isoband_assemble_polygons",     (DL_FUNC) &_isoband_assemble_polygons,     4},
+    {"_isoband_clip_lines_boxes_impl", (DL_FUNC) &_isoband_clip_lines_boxes_impl, 9},
+    {"_isoband_clip_lines_impl",       (DL_FUNC) &_isoband_clip_lines_impl,       9},
+    {"_isoband_iso_grid_impl",         (DL_FUNC) &_isoband_iso_grid_impl,         3},
+    {"_isoband_iso_grid_update_impl",  (DL_FUNC) &_isoband_iso_grid_update_impl,  4},
+    {"_isoband_iso_locate_impl",       (DL_FUNC) &_isoband_iso_locate_impl,       4},
+    {"_isoband_iso_locator_impl",      (DL_FUNC) &_isoband_iso_locator_impl,      3},
+    {"_isoband_isobands_batch_impl",   (DL_FUNC) &_isoband_isobands_batch_impl,   6},
+    {"_isoband_isobands_file_impl",    (DL_FUNC) &_isoband_isobands_file_impl,    10},
+    {"_isoband_isobands_grid_impl",    (DL_FUNC) &_isoband_isobands_grid_impl,    8},
+    {"_isoband_isobands_impl",         (DL_FUNC) &_isoband_isobands_impl,         10},
+    {"_isoband_isobands_stack_impl",   (DL_FUNC) &_isoband_isobands_stack_impl,   6},
+    {"_isoband_isobands_stats_impl",   (DL_FUNC) &_isoband_isobands_stats_impl,   6},
+    {"_isoband_isobands_stream_impl",  (DL_FUNC) &_isoband_isobands_stream_impl,  6},
+    {"_isoband_isolines_batch_impl",   (DL_FUNC) &_isoband_isolines_batch_impl,   5},
+    {"_isoband_isolines_file_impl",    (DL_FUNC) &_isoband_isolines_file_impl,    9},
+    {"_isoband_isolines_grid_impl",    (DL_FUNC) &_isoband_isolines_grid_impl,    6},
+    {"_isoband_isolines_impl",         (DL_FUNC) &_isoband_isolines_impl,         8},
+    {"_isoband_isolines_stack_impl",   (DL_FUNC) &_isoband_isolines_stack_impl,   5},
+    {"_isoband_isolines_stats_impl",   (DL_FUNC) &_isoband_isolines_stats_impl,   5},
+    {"_isoband_isolines_stream_impl",  (DL_FUNC) &_isoband_isolines_stream_impl,  5},
+    {"_isoband_path_metrics_impl",     (DL_FUNC) &_isoband_path_metrics_impl,     4},
+    {"_isoband_separate_polygons",     (DL_FUNC) &_isoband_separate_polygons,     3},
     {NULL, NULL, 0}
 };
 }
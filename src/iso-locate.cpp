@@ -0,0 +1,204 @@
+#include "cpp11/external_pointer.hpp"
+#include "cpp11/doubles.hpp"
+#include "cpp11/integers.hpp"
+#include "cpp11/list.hpp"
+#include "cpp11/protect.hpp"
+#include "cpp11/sexp.hpp"
+#define R_NO_REMAP
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace std;
+using namespace cpp11::literals;
+
+#include "polygon.h" // for in_polygon_type
+#include "parallel.h" // for parallel_for
+
+/* Finds the isoband that each of many points lies in. The edges of all rings of
+ * all bands are sorted into horizontal slabs, and a point is classified like
+ * point_in_polygon() does, by casting a ray to the right and counting the edges
+ * it crosses, but only over the edges of the slab containing it. Points on an
+ * edge are undetermined. The slab height is chosen so that a slab holds about
+ * as many edges as a horizontal line crosses, which is what the ray has to look
+ * at in any case.
+ */
+class band_locator {
+protected:
+  // an edge of a ring, from its lower to its upper end
+  struct edge {
+    double x0, y0, x1, y1;
+    int band;
+  };
+
+  int n_bands;
+  double ymin, ymax, slab_height;
+  int n_slabs;
+  vector<R_xlen_t> slab_start; // edges of slab s are slab_edges[slab_start[s]] ... slab_edges[slab_start[s+1]-1]
+  vector<edge> slab_edges;     // ordered by band within each slab
+
+  int slab(double y) const {
+    int s = (int)((y - ymin) / slab_height);
+    return max(0, min(s, n_slabs - 1));
+  }
+
+public:
+  band_locator(cpp11::list xs, cpp11::list ys, cpp11::list ids) : n_bands(xs.size()) {
+    if (ys.size() != n_bands || ids.size() != n_bands) {
+      cpp11::stop("Inputs x, y, and id must be of the same length.");
+    }
+
+    // all edges, including the one closing each ring
+    vector<edge> edges;
+    double total_height = 0;
+    ymin = INFINITY;
+    ymax = -INFINITY;
+    for (int k = 0; k < n_bands; k++) {
+      cpp11::doubles x(xs[k]), y(ys[k]);
+      cpp11::integers id(ids[k]);
+      R_xlen_t n = x.size();
+      if (y.size() != n || id.size() != n) {
+        cpp11::stop("Inputs x, y, and id must be of the same length.");
+      }
+      const double *x_p = REAL(x), *y_p = REAL(y);
+      const int *id_p = INTEGER(id);
+
+      R_xlen_t start = 0;
+      for (R_xlen_t i = 0; i < n; i++) {
+        if (i > 0 && id_p[i] != id_p[i-1]) start = i;
+        R_xlen_t j = (i + 1 < n && id_p[i+1] == id_p[i]) ? i + 1 : start;
+        edge e = (y_p[i] <= y_p[j]) ? edge{x_p[i], y_p[i], x_p[j], y_p[j], k} : edge{x_p[j], y_p[j], x_p[i], y_p[i], k};
+        edges.push_back(e);
+        total_height += e.y1 - e.y0;
+        ymin = min(ymin, e.y0);
+        ymax = max(ymax, e.y1);
+      }
+    }
+
+    // number of slabs
+    R_xlen_t n_edges = edges.size();
+    double height = ymax - ymin;
+    n_slabs = 1;
+    if (n_edges > 0 && total_height > 0 && height > 0) {
+      double s = n_edges * height / total_height;
+      n_slabs = (int)max(1.0, min(s, min((double)n_edges, 1e7)));
+    }
+    slab_height = (n_edges > 0 && height > 0) ? height / n_slabs : 1;
+
+    // count the edges per slab, then fill them in at their exact positions
+    slab_start.assign(n_slabs + 1, 0);
+    for (auto it = edges.begin(); it != edges.end(); it++) {
+      for (int s = slab(it->y0); s <= slab(it->y1); s++) {
+        slab_start[s + 1]++;
+      }
+    }
+    for (int s = 0; s < n_slabs; s++) {
+      slab_start[s + 1] += slab_start[s];
+    }
+    slab_edges.resize(slab_start[n_slabs]);
+    vector<R_xlen_t> fill(slab_start.begin(), slab_start.end() - 1);
+    for (auto it = edges.begin(); it != edges.end(); it++) {
+      for (int s = slab(it->y0); s <= slab(it->y1); s++) {
+        slab_edges[fill[s]++] = *it;
+      }
+    }
+  }
+
+  /* Locate the point (px, py). Returns the first band the point lies inside of,
+   * or else the first band on whose boundary it lies, or -1 if it lies in no
+   * band, and in status whether it lies inside, on the boundary (undetermined),
+   * or outside.
+   */
+  int locate(double px, double py, in_polygon_type &status) const {
+    status = outside;
+    if (py < ymin || py > ymax) return -1;
+
+    int s = slab(py);
+    auto it = slab_edges.begin() + slab_start[s], end = slab_edges.begin() + slab_start[s + 1];
+    int boundary = -1;
+    while (it != end) {
+      int band = it->band;
+      bool odd = false, on_edge = false;
+      for (; it != end && it->band == band; it++) {
+        const edge &e = *it;
+        if (py < e.y0 || py > e.y1) continue;
+        if (e.y0 == e.y1) {
+          // horizontal edges cross no ray, but the point may lie on one
+          if (px >= min(e.x0, e.x1) && px <= max(e.x0, e.x1)) on_edge = true;
+          continue;
+        }
+        double xint = e.x0 + (py - e.y0) / (e.y1 - e.y0) * (e.x1 - e.x0);
+        if (xint == px) {
+          on_edge = true;
+        } else if (xint > px && py < e.y1) {
+          // each edge counts with its lower end only, so that a ray through a
+          // vertex crosses each ring there either twice or not at all
+          odd = !odd;
+        }
+      }
+
+      if (on_edge) {
+        if (boundary < 0) boundary = band;
+      } else if (odd) {
+        status = inside;
+        return band;
+      }
+    }
+
+    if (boundary >= 0) status = undetermined;
+    return boundary;
+  }
+};
+
+// a band_locator that lives as long as the R object holding it, see iso_locator()
+[[cpp11::register]]
+SEXP iso_locator_impl(cpp11::list x, cpp11::list y, cpp11::list id) {
+  return cpp11::external_pointer<band_locator>(new band_locator(x, y, id));
+}
+
+/* Locate the points (x, y) in parallel. Returns the 1-based index of the band
+ * each point lies in and its status, 1 for inside, 2 for outside, and 3 for
+ * undetermined, or NA for both if a coordinate is NA.
+ */
+[[cpp11::register]]
+cpp11::writable::list iso_locate_impl(cpp11::sexp locator, cpp11::doubles x, cpp11::doubles y, int threads) {
+  if (TYPEOF(locator) != EXTPTRSXP) {
+    cpp11::stop("Invalid locator handle.");
+  }
+  const band_locator *loc = cpp11::external_pointer<band_locator>(locator).get();
+  if (!loc) {
+    // external pointers don't survive saving and reloading
+    cpp11::stop("The locator handle is no longer valid; it has to be created again with iso_locator().");
+  }
+  R_xlen_t n = x.size();
+  if (y.size() != n) {
+    cpp11::stop("Inputs x and y must be of the same length.");
+  }
+
+  cpp11::writable::integers band(n), status(n);
+  const double *x_p = REAL(x), *y_p = REAL(y);
+  int *band_p = INTEGER(band), *status_p = INTEGER(status);
+
+  const R_xlen_t chunk = 16384;
+  int n_chunks = (int)((n + chunk - 1) / chunk);
+  parallel_for(n_chunks, threads, [&](int c, int) {
+    R_xlen_t end = min(n, (c + 1) * chunk);
+    for (R_xlen_t i = c * chunk; i < end; i++) {
+      if (ISNAN(x_p[i]) || ISNAN(y_p[i])) {
+        band_p[i] = NA_INTEGER;
+        status_p[i] = NA_INTEGER;
+        continue;
+      }
+      in_polygon_type st;
+      int b = loc->locate(x_p[i], y_p[i], st);
+      band_p[i] = (b < 0) ? NA_INTEGER : b + 1;
+      status_p[i] = (int)st + 1;
+    }
+  }, []() {cpp11::check_user_interrupt();});
+
+  return cpp11::writable::list({
+    "band"_nm = band,
+    "status"_nm = status
+  });
+}
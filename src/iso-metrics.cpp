@@ -0,0 +1,44 @@
+#include "cpp11/doubles.hpp"
+#include "cpp11/integers.hpp"
+#include "cpp11/list.hpp"
+#include "cpp11/protect.hpp"
+#define R_NO_REMAP
+
+using namespace std;
+using namespace cpp11::literals;
+
+#include "iso-metrics.h"
+
+/* Measure the paths of one isoband or isoline level, given as the x, y, and id
+ * vectors returned by isobands() or isolines(), in a single pass over them; used
+ * for contours whose paths weren't measured while they were collected, see
+ * isobander::set_measure_paths(). A path is a run
+ * of points with the same id. Polygon rings (closed = true) are closed implicitly,
+ * by an edge from the last point back to the first; lines are closed if they end
+ * where they start, and only closed lines have an area, NA otherwise. Areas are
+ * signed, positive for paths running counterclockwise in the x-y plane.
+ */
+[[cpp11::register]]
+cpp11::writable::list path_metrics_impl(cpp11::doubles x, cpp11::doubles y, cpp11::integers id, bool closed) {
+  R_xlen_t n = x.size();
+  if (y.size() != n || id.size() != n) {
+    cpp11::stop("Inputs x, y, and id must be of the same length.");
+  }
+  const double *x_p = REAL(x), *y_p = REAL(y);
+  const int *id_p = INTEGER(id);
+
+  path_metrics metrics;
+  R_xlen_t start = 0;
+  while (start < n) {
+    R_xlen_t end = start + 1;
+    while (end < n && id_p[end] == id_p[start]) end++;
+
+    path_measure m;
+    for (R_xlen_t i = start; i < end; i++) {
+      m.add(point(x_p[i], y_p[i]));
+    }
+    metrics.add(id_p[start], m, closed, closed || (end - start > 1 && m.last == m.first));
+    start = end;
+  }
+  return metrics.as_list();
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "cpp11/doubles.hpp"
+#include "cpp11/integers.hpp"
+#include "cpp11/list.hpp"
+#define R_NO_REMAP
+
+#include <vector>
+#include <algorithm>
+
+#include "polygon.h" // for path_measure
+
+using namespace cpp11::literals;
+
+// the measurements of the paths of one contour level, one entry per path, as
+// returned by iso_metrics(): id, signed area (NA for lines that aren't closed),
+// length, and bounding box
+struct path_metrics {
+  vector<int> id;
+  vector<double> area, length, xmin, xmax, ymin, ymax;
+
+  // adds the path with the given id measured in m; the length of a ring
+  // includes the edge closing it
+  void add(int path_id, const path_measure &m, bool ring, bool has_area) {
+    id.push_back(path_id);
+    area.push_back(has_area ? m.area2 / 2 : NA_REAL);
+    length.push_back(ring ? m.closed_length() : m.length);
+    xmin.push_back(m.xmin);
+    xmax.push_back(m.xmax);
+    ymin.push_back(m.ymin);
+    ymax.push_back(m.ymax);
+  }
+
+  // adds path k of other, with the given id
+  void add(int path_id, const path_metrics &other, size_t k) {
+    id.push_back(path_id);
+    area.push_back(other.area[k]);
+    length.push_back(other.length[k]);
+    xmin.push_back(other.xmin[k]);
+    xmax.push_back(other.xmax[k]);
+    ymin.push_back(other.ymin[k]);
+    ymax.push_back(other.ymax[k]);
+  }
+
+  void clear() {
+    id.clear();
+    area.clear();
+    length.clear();
+    xmin.clear();
+    xmax.clear();
+    ymin.clear();
+    ymax.clear();
+  }
+
+  cpp11::writable::list as_list() const {
+    R_xlen_t n = id.size();
+    cpp11::writable::integers id_out(n);
+    copy(id.begin(), id.end(), INTEGER(id_out));
+    return cpp11::writable::list({
+      "id"_nm = id_out,
+      "area"_nm = doubles_of(area),
+      "length"_nm = doubles_of(length),
+      "xmin"_nm = doubles_of(xmin),
+      "xmax"_nm = doubles_of(xmax),
+      "ymin"_nm = doubles_of(ymin),
+      "ymax"_nm = doubles_of(ymax)
+    });
+  }
+
+private:
+  static cpp11::writable::doubles doubles_of(const vector<double> &v) {
+    cpp11::writable::doubles out(v.size());
+    copy(v.begin(), v.end(), REAL(out));
+    return out;
+  }
+};
@@ -5,20 +5,73 @@
 
 #include "cpp11/data_frame.hpp"
 #include "cpp11/doubles.hpp"
+#include "cpp11/external_pointer.hpp"
+#include "cpp11/function.hpp"
 #include "cpp11/integers.hpp"
 #include "cpp11/list.hpp"
 #include "cpp11/matrix.hpp"
 #include "cpp11/protect.hpp"
+#include "cpp11/sexp.hpp"
 #define R_NO_REMAP
 
 #include <iostream>
 #include <vector>
-#include <unordered_map>
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
 
 using namespace std;
 using namespace cpp11::literals;
 
 #include "polygon.h" // for point
+#include "parallel.h" // for parallel_for
+#include "classify.h" // for classify_points, combine_cells
+#include "mapped-file.h" // for mapped_file
+#include "separate-polygons.h" // for point_in_polygon
+#include "iso-metrics.h" // for path_metrics
+
+// element types of the grid values. Grids from R are double or integer
+// matrices, and grids read from files can also be floats or 16-bit integers;
+// all of them are contoured as they are, without conversion to double.
+enum value_type {values_double, values_float, values_int32, values_int16};
+
+// value_traits<T>::as_double() converts a grid value of type T to double,
+// with R's NA for integers becoming NA_real_
+template <class T> struct value_traits;
+
+template <> struct value_traits<double> {
+  static const value_type type = values_double;
+  static double as_double(double v) {return v;}
+};
+
+template <> struct value_traits<float> {
+  static const value_type type = values_float;
+  static double as_double(float v) {return v;}
+};
+
+template <> struct value_traits<int32_t> {
+  static const value_type type = values_int32;
+  static double as_double(int32_t v) {return v == NA_INTEGER ? NA_REAL : v;}
+};
+
+template <> struct value_traits<int16_t> {
+  static const value_type type = values_int16;
+  static double as_double(int16_t v) {return v;}
+};
+
+// the values of an R matrix, which are contoured in place
+const void *matrix_values(SEXP z) {
+  return TYPEOF(z) == INTSXP ? (const void *)INTEGER(z) : (const void *)REAL(z);
+}
+
+value_type matrix_value_type(SEXP z) {
+  return TYPEOF(z) == INTSXP ? values_int32 : values_double;
+}
 
 // point in abstract grid space
 enum point_type {
@@ -39,18 +92,6 @@ struct grid_point {
   grid_point(const grid_point &p) : r(p.r), c(p.c), type(p.type) {}
 };
 
-// hash function for grid_point
-struct grid_point_hasher {
-  size_t operator()(const grid_point& p) const
-  {
-    // this should work up to about 100,000,000 rows/columns
-    return hash<long long>()(
-      (static_cast<long long>(p.r) << 30) ^
-        (static_cast<long long>(p.c) << 3) ^
-          static_cast<long long>(p.type));
-  }
-};
-
 bool operator==(const grid_point &p1, const grid_point &p2) {
   return (p1.r == p2.r) && (p1.c == p2.c) && (p1.type == p2.type);
 }
@@ -62,13 +103,15 @@ ostream & operator<<(ostream &out, const grid_point &p) {
 
 // connection between points in grid space
 struct point_connect {
-  grid_point prev, next; // previous and next points in polygon
-  grid_point prev2, next2; // alternative previous and next, when two separate polygons have vertices on the same grid point
+  int prev, next; // previous and next points in polygon, as indices into the point store; -1 if none
+  int prev2, next2; // alternative previous and next, when two separate polygons have vertices on the same grid point
+  int region, region2; // for isobands, the regions of the band bordered by the two connections, see grid_store
 
   bool altpoint;  // does this connection hold an alternative point?
   bool collected, collected2; // has this connection been collected into a final polygon?
 
-  point_connect() : altpoint(false), collected(false), collected2(false) {};
+  point_connect() :
+    prev(-1), next(-1), prev2(-1), next2(-1), region(-1), region2(-1), altpoint(false), collected(false), collected2(false) {};
 };
 
 ostream & operator<<(ostream &out, const point_connect &pc) {
@@ -79,24 +122,722 @@ ostream & operator<<(ostream &out, const point_connect &pc) {
   return out;
 }
 
+// storage for the polygon topology. Points are kept in a flat pool and refer
+// to each other by pool index, so following a polygon never requires a lookup.
+// Finding the pool entry for a grid location goes through a dense slot index.
+// The grid is processed in blocks of up to block_rows cell rows, and within a
+// block one cell column at a time, following the column-major layout of the
+// data. Elementary polygons only touch the two grid columns bordering the
+// current cell column, so the slot index covers the rows inside the block for
+// a sliding window of two columns; columns are retired via advance() as the
+// cell loop moves across the block. The top and bottom grid rows of the block
+// are indexed separately over their full width, since they are shared with the
+// neighboring blocks. This keeps the points being worked on in cache for grids
+// of any shape. Nothing is allocated per point once the pool has grown to its
+// working size, and clear() keeps all capacity for the next level. Window slots
+// are reset individually, from a list of the ones in use, so that stretches
+// of the grid without any contour cost nothing here.
+//
+// For isobands, the store also records which parts of the band are connected.
+// Each elementary polygon belongs to a region, and regions are joined whenever
+// polygons are merged along an edge; the regions form a union-find forest, in
+// which each region points to one it was joined with, and a region pointing
+// to itself stands for all regions leading to it. Polygons that merely touch
+// in a point stay in separate regions, as they are separate polygons.
+class grid_store {
+  static const int n_types = 5; // number of point types
+
+  int ncol;
+  int r_top, r_bottom;         // grid rows bordering the current block
+  vector<int> window;          // pool index for each (col parity, row - r_top, type); -1 if unused
+  vector<int> window_used[2];  // window slots that may be set, by column parity
+  vector<int> top_row, bottom_row; // pool index for each (col, type) on rows r_top and r_bottom
+  vector<grid_point> points;   // grid location of each pool entry; r == -1 marks a free entry
+  vector<point_connect> connects;
+  vector<int> free_entries;    // pool entries released by erase(), available for reuse
+  vector<int> regions;         // region each region was joined with, see find_region()
+
+  int slot_index(const grid_point &p) const {
+    return ((p.c & 1) * (block_rows + 1) + p.r - r_top) * n_types + p.type;
+  }
+
+  int &slot(const grid_point &p) {
+    if (p.r == r_top) return top_row[p.c * n_types + p.type];
+    if (p.r == r_bottom) return bottom_row[p.c * n_types + p.type];
+    return window[slot_index(p)];
+  }
+
+  vector<int> &edge_row(int r) {
+    return (r == r_top) ? top_row : bottom_row;
+  }
+
+  void reset_window(int parity) {
+    for (auto it = window_used[parity].begin(); it != window_used[parity].end(); it++) {
+      window[*it] = -1;
+    }
+    window_used[parity].clear();
+  }
+
+public:
+  static const int block_rows = 512; // maximum number of cell rows per block
+
+  grid_store(int ncol_in = 0) :
+    ncol(ncol_in), r_top(-1), r_bottom(-1), window(2 * (block_rows + 1) * n_types, -1),
+    top_row(ncol_in * n_types, -1), bottom_row(ncol_in * n_types, -1) {}
+
+  void clear() {
+    r_top = r_bottom = -1;
+    reset_window(0);
+    reset_window(1);
+    fill(top_row.begin(), top_row.end(), -1);
+    fill(bottom_row.begin(), bottom_row.end(), -1);
+    points.clear();
+    connects.clear();
+    free_entries.clear();
+    regions.clear();
+  }
+
+  // called before processing the cell rows r_first, ..., r_last-1, at most
+  // block_rows of them. When the block continues the previous one, the points
+  // on their shared grid row remain available.
+  void start_block(int r_first, int r_last) {
+    if (r_first == r_bottom) {
+      top_row.swap(bottom_row);
+    } else {
+      fill(top_row.begin(), top_row.end(), -1);
+    }
+    fill(bottom_row.begin(), bottom_row.end(), -1);
+    reset_window(0);
+    reset_window(1);
+    r_top = r_first;
+    r_bottom = r_last;
+  }
+
+  // called before processing cell column c of the current block; forgets the slot
+  // index of grid column c-1, which no later cell can touch, so that it can be
+  // reused for column c+1
+  void advance(int c) {
+    if (c > 0) reset_window((c - 1) & 1);
+  }
+
+  // returns the pool entry for grid point p, creating an empty one if needed;
+  // `existed` records whether the point was already present
+  int lookup(const grid_point &p, bool &existed) {
+    int &s = slot(p);
+    existed = (s >= 0);
+    if (!existed) {
+      if (p.r != r_top && p.r != r_bottom) {
+        window_used[p.c & 1].push_back(&s - window.data());
+      }
+      if (free_entries.empty()) {
+        s = points.size();
+        points.push_back(p);
+        connects.push_back(point_connect());
+      } else {
+        s = free_entries.back();
+        free_entries.pop_back();
+        points[s] = p;
+        connects[s] = point_connect();
+      }
+    }
+    return s;
+  }
+
+  // returns the pool entry for grid point p, which must lie in the current
+  // block and column window, or -1 if there is none
+  int find(const grid_point &p) const {
+    if (p.r == r_top) return top_row[p.c * n_types + p.type];
+    if (p.r == r_bottom) return bottom_row[p.c * n_types + p.type];
+    return window[slot_index(p)];
+  }
+
+  // releases pool entry i; must not be referenced by any remaining point
+  void erase(int i) {
+    slot(points[i]) = -1;
+    release(i);
+  }
+
+  // releases pool entry i without touching the slot index, for points that
+  // the slot index no longer covers, i.e., neither on the bottom grid row nor
+  // in a block that is still being processed
+  void release(int i) {
+    points[i].r = -1;
+    free_entries.push_back(i);
+  }
+
+  // appends the pool of another store, e.g. one holding the topology of a
+  // different part of the grid; returns the offset added to its pool indices
+  int append(const grid_store &other) {
+    int offset = points.size(), region_offset = regions.size();
+    points.insert(points.end(), other.points.begin(), other.points.end());
+    for (auto it = other.connects.begin(); it != other.connects.end(); it++) {
+      point_connect pc = *it;
+      if (pc.prev >= 0) pc.prev += offset;
+      if (pc.next >= 0) pc.next += offset;
+      if (pc.prev2 >= 0) pc.prev2 += offset;
+      if (pc.next2 >= 0) pc.next2 += offset;
+      if (pc.region >= 0) pc.region += region_offset;
+      if (pc.region2 >= 0) pc.region2 += region_offset;
+      connects.push_back(pc);
+    }
+    for (auto it = other.free_entries.begin(); it != other.free_entries.end(); it++) {
+      free_entries.push_back(*it + offset);
+    }
+    for (auto it = other.regions.begin(); it != other.regions.end(); it++) {
+      regions.push_back(*it + region_offset);
+    }
+    return offset;
+  }
+
+  // starts a new region, and returns it
+  int add_region() {
+    regions.push_back(regions.size());
+    return regions.size() - 1;
+  }
+
+  // the region standing for region a and all regions joined with it
+  int find_region(int a) {
+    while (regions[a] != a) {
+      a = regions[a] = regions[regions[a]]; // halve the path on the way
+    }
+    return a;
+  }
+
+  // joins regions a and b, and returns the region standing for both
+  int join_regions(int a, int b) {
+    a = find_region(a);
+    b = find_region(b);
+    if (a == b) return a;
+    if (b < a) swap(a, b);
+    regions[b] = a;
+    return a;
+  }
+
+  int n_regions() const {return regions.size();}
+
+  // slot index of grid row r, which must border the current block
+  vector<int> row_slots(int r) {
+    return edge_row(r);
+  }
+
+  // restores a slot index obtained from row_slots() as grid row r, which
+  // must border the current block, with pool indices shifted by offset
+  void set_row_slots(int r, const vector<int> &row, int offset) {
+    auto out = edge_row(r).begin();
+    for (auto it = row.begin(); it != row.end(); it++, out++) {
+      *out = (*it >= 0) ? *it + offset : -1;
+    }
+  }
+
+  // marks all points as not yet collected into an output path
+  void reset_collected() {
+    for (auto it = connects.begin(); it != connects.end(); it++) {
+      it->collected = it->collected2 = false;
+    }
+  }
+
+  int size() const {return points.size();}
+  int n_in_use() const {return points.size() - free_entries.size();}
+  bool in_use(int i) const {return points[i].r >= 0;}
+  const grid_point &point_at(int i) const {return points[i];}
+  point_connect &operator[](int i) {return connects[i];}
+};
+
+// std::min() and friends take their arguments by reference
+const int grid_store::block_rows;
+
+// Ranges of the grid values in square tiles of tile_size x tile_size cells,
+// computed once per grid and shared by all levels. A tile whose finite values
+// are all below a level, or all at or above it, has no contour at that level,
+// so the cell loops skip it without classifying anything (see
+// isobander::process_cells()). For narrow levels on large grids this leaves
+// only the tiles along the contour. Tile (tr, tc) covers the cells in rows
+// tr*tile_size, ..., (tr+1)*tile_size - 1 and the corresponding columns, and
+// the ranges include the grid points on all four sides of these cells.
+class grid_ranges {
+  int nrow, ncol;
+  int n_tile_rows, n_tile_cols;
+  vector<double> zmin, zmax; // tile by tile, column-major; +Inf/-Inf if no values
+
+  // computes the ranges of the tiles in rows tr_first, ..., tr_last and
+  // columns tc_first, ..., tc_last
+  template <class T>
+  void build(const T *z, int tr_first, int tr_last, int tc_first, int tc_last) {
+    for (int tc = tc_first; tc <= tc_last; tc++) {
+      for (int tr = tr_first; tr <= tr_last; tr++) {
+        zmin[tc * n_tile_rows + tr] = R_PosInf;
+        zmax[tc * n_tile_rows + tr] = R_NegInf;
+      }
+    }
+
+    int g_last = min((tc_last + 1) * tile_size, ncol - 1);
+    for (int g = tc_first * tile_size; g <= g_last; g++) {
+      // grid column g borders the cell columns g-1 and g
+      int tc_lo = max(tc_first, (g > 0) ? (g - 1) / tile_size : 0);
+      int tc_hi = min(tc_last, min(g, ncol - 2) / tile_size);
+      const T *col = z + (ptrdiff_t)g * nrow;
+      for (int tr = tr_first; tr <= tr_last; tr++) {
+        double lo = R_PosInf, hi = R_NegInf; // comparisons with NaN are false
+        int r_last = min((tr + 1) * tile_size, nrow - 1);
+        for (int r = tr * tile_size; r <= r_last; r++) {
+          double v = value_traits<T>::as_double(col[r]);
+          if (v < lo) lo = v;
+          if (v > hi) hi = v;
+        }
+        for (int tc = tc_lo; tc <= tc_hi; tc++) {
+          int i = tc * n_tile_rows + tr;
+          zmin[i] = min(zmin[i], lo);
+          zmax[i] = max(zmax[i], hi);
+        }
+      }
+    }
+  }
+
+  void build(const void *z, value_type type, int tr_first, int tr_last, int tc_first, int tc_last) {
+    if (nrow < 2 || ncol < 2) return;
+
+    switch (type) {
+    case values_float: build(static_cast<const float *>(z), tr_first, tr_last, tc_first, tc_last); break;
+    case values_int32: build(static_cast<const int32_t *>(z), tr_first, tr_last, tc_first, tc_last); break;
+    case values_int16: build(static_cast<const int16_t *>(z), tr_first, tr_last, tc_first, tc_last); break;
+    default: build(static_cast<const double *>(z), tr_first, tr_last, tc_first, tc_last);
+    }
+  }
+
+public:
+  static const int tile_size = 32;
+
+  grid_ranges(const void *z, value_type type, int nrow_in, int ncol_in) :
+    nrow(nrow_in), ncol(ncol_in),
+    n_tile_rows(max(nrow - 2, -1) / tile_size + 1), n_tile_cols(max(ncol - 2, -1) / tile_size + 1),
+    zmin(n_tile_rows * n_tile_cols, R_PosInf), zmax(n_tile_rows * n_tile_cols, R_NegInf)
+  {
+    build(z, type, 0, n_tile_rows - 1, 0, n_tile_cols - 1);
+  }
+
+  // recomputes the ranges after the values of the grid points in rows r_first, ..., r_last
+  // and columns c_first, ..., c_last have changed
+  void update(const void *z, value_type type, int r_first, int r_last, int c_first, int c_last) {
+    // the cells with these grid points as corners
+    int tr_first = max(r_first - 1, 0) / tile_size, tr_last = min(r_last, nrow - 2) / tile_size;
+    int tc_first = max(c_first - 1, 0) / tile_size, tc_last = min(c_last, ncol - 2) / tile_size;
+    build(z, type, tr_first, tr_last, tc_first, tc_last);
+  }
+
+  // smallest and largest value in the tile containing cell (r, c)
+  double min_at(int r, int c) const {return zmin[(c / tile_size) * n_tile_rows + r / tile_size];}
+  double max_at(int r, int c) const {return zmax[(c / tile_size) * n_tile_rows + r / tile_size];}
+
+  // whether the tile containing cell (r, c) has values at or above lo and below hi
+  bool overlaps(int r, int c, double lo, double hi) const {
+    return max_at(r, c) >= lo && min_at(r, c) < hi;
+  }
+};
+
+const int grid_ranges::tile_size;
+
+// the x, y, and id vectors returned to R for one contour
+cpp11::writable::list path_list(SEXP x, SEXP y, SEXP id) {
+  return cpp11::writable::list({
+    "x"_nm = x,
+    "y"_nm = y,
+    "id"_nm = id
+  });
+}
+
+// the parent vector returned to R for the rings of one isoband, see
+// isobander::find_parents()
+cpp11::writable::integers parents_of(const vector<int> &parent) {
+  cpp11::writable::integers out(parent.size());
+  copy(parent.begin(), parent.end(), INTEGER(out));
+  return out;
+}
+
+// polygon or line paths stored in plain C++ vectors, so they can be
+// assembled on threads other than the R main thread
+struct contour_paths {
+  vector<double> x, y;
+  vector<int> id;
+  bool has_parents = false; // whether parent holds the outer ring of each polygon ring
+  vector<int> parent;
+  bool measured = false; // whether metrics holds the measurements of the paths
+  path_metrics metrics;
+
+  cpp11::writable::list as_list() const {
+    R_xlen_t n = id.size();
+    cpp11::writable::doubles x_out(n), y_out(n);
+    cpp11::writable::integers id_out(n);
+    copy(x.begin(), x.end(), REAL(x_out));
+    copy(y.begin(), y.end(), REAL(y_out));
+    copy(id.begin(), id.end(), INTEGER(id_out));
+    cpp11::writable::list out = path_list(x_out, y_out, id_out);
+    if (has_parents) out.push_back("parent"_nm = parents_of(parent));
+    if (measured) out.push_back("metrics"_nm = metrics.as_list());
+    return out;
+  }
+};
+
+// the range of cell rows, from first to last, touched by each path of a
+// contour, in the order of their ids, and by the paths left out of it; see
+// isobander::collect_paths()
+struct path_rows {
+  vector<int> first, last;
+  vector<int> dropped_first, dropped_last;
+
+  void clear() {
+    first.clear();
+    last.clear();
+    dropped_first.clear();
+    dropped_last.clear();
+  }
+
+  void add(bool kept, int r_first, int r_last) {
+    (kept ? first : dropped_first).push_back(r_first);
+    (kept ? last : dropped_last).push_back(r_last);
+  }
+};
+
+// The points of a cell at which its elementary polygons can have vertices: the
+// four corners, and the crossings of the low and high values on its four edges.
+// For cell (r, c), top is grid row r and left is grid column c.
+enum cell_vertex : unsigned char {
+  top_left, top_right, bottom_right, bottom_left,
+  top_lo, top_hi, right_lo, right_hi, bottom_lo, bottom_hi, left_lo, left_hi
+};
+
+// the grid point of each cell vertex, relative to the top left corner of the cell
+struct vertex_offset {
+  int dr, dc;
+  point_type type;
+};
+
+constexpr vertex_offset cell_vertex_points[] = {
+  {0, 0, grid}, {0, 1, grid}, {1, 1, grid}, {1, 0, grid},
+  {0, 0, hintersect_lo}, {0, 0, hintersect_hi}, {0, 1, vintersect_lo}, {0, 1, vintersect_hi},
+  {1, 0, hintersect_lo}, {1, 0, hintersect_hi}, {0, 0, vintersect_lo}, {0, 0, vintersect_hi}
+};
+
+// the sides of the cell each cell vertex lies on, as bits: top 1, right 2, bottom 4, left 8
+enum cell_side : unsigned char {top_side = 1, right_side = 2, bottom_side = 4, left_side = 8};
+
+constexpr unsigned char cell_vertex_sides[] = {
+  top_side | left_side, top_side | right_side, bottom_side | right_side, bottom_side | left_side,
+  top_side, top_side, right_side, right_side, bottom_side, bottom_side, left_side, left_side
+};
+
+// the elementary polygons of a cell: at most two, with at most 8 vertices in
+// total, all drawn clockwise for proper merging
+struct cell_polygons {
+  unsigned char size[2]; // number of vertices of each polygon, 0 if there's none
+  cell_vertex vertex[8];
+};
+
+// elementary polygons of the cells with ternary index 0 to 80; the digits of the
+// index, given in the comments, are the classes of the top left, top right, bottom
+// right, and bottom left corners (0: below the band, 1: in the band, 2: above the
+// band). Saddle cells, whose polygons depend on the value at the center of the
+// cell, have three variants, for central values below, in, and above the band.
+// All other cells only have the middle one.
+constexpr cell_polygons band_polygons[81][3] = {
+  {{}, {}, {}}, // 0000
+  {{}, {{3}, {left_lo, bottom_lo, bottom_left}}, {}}, // 0001
+  {{}, {{4}, {left_lo, bottom_lo, bottom_hi, left_hi}}, {}}, // 0002
+  {{}, {{3}, {right_lo, bottom_right, bottom_lo}}, {}}, // 0010
+  {{}, {{4}, {left_lo, right_lo, bottom_right, bottom_left}}, {}}, // 0011
+  {{}, {{5}, {left_lo, right_lo, bottom_right, bottom_hi, left_hi}}, {}}, // 0012
+  {{}, {{4}, {bottom_lo, right_lo, right_hi, bottom_hi}}, {}}, // 0020
+  {{}, {{5}, {bottom_left, left_lo, right_lo, right_hi, bottom_hi}}, {}}, // 0021
+  {{}, {{4}, {left_lo, right_lo, right_hi, left_hi}}, {}}, // 0022
+  {{}, {{3}, {top_lo, top_right, right_lo}}, {}}, // 0100
+  { // 0101
+    {{3, 3}, {bottom_left, left_lo, bottom_lo, top_right, right_lo, top_lo}},
+    {{6}, {bottom_left, left_lo, top_lo, top_right, right_lo, bottom_lo}},
+    {{6}, {bottom_left, left_lo, top_lo, top_right, right_lo, bottom_lo}}
+  },
+  { // 0102
+    {{3, 4}, {top_right, right_lo, top_lo, left_lo, bottom_lo, bottom_hi, left_hi}},
+    {{7}, {top_right, right_lo, bottom_lo, bottom_hi, left_hi, left_lo, top_lo}},
+    {{7}, {top_right, right_lo, bottom_lo, bottom_hi, left_hi, left_lo, top_lo}}
+  },
+  {{}, {{4}, {top_lo, top_right, bottom_right, bottom_lo}}, {}}, // 0110
+  {{}, {{5}, {bottom_left, left_lo, top_lo, top_right, bottom_right}}, {}}, // 0111
+  {{}, {{6}, {top_right, bottom_right, bottom_hi, left_hi, left_lo, top_lo}}, {}}, // 0112
+  {{}, {{5}, {top_right, right_hi, bottom_hi, bottom_lo, top_lo}}, {}}, // 0120
+  {{}, {{6}, {top_right, right_hi, bottom_hi, bottom_left, left_lo, top_lo}}, {}}, // 0121
+  {{}, {{5}, {top_right, right_hi, left_hi, left_lo, top_lo}}, {}}, // 0122
+  {{}, {{4}, {right_lo, top_lo, top_hi, right_hi}}, {}}, // 0200
+  { // 0201
+    {{3, 4}, {bottom_left, left_lo, bottom_lo, right_lo, top_lo, top_hi, right_hi}},
+    {{7}, {bottom_left, left_lo, top_lo, top_hi, right_hi, right_lo, bottom_lo}},
+    {{7}, {bottom_left, left_lo, top_lo, top_hi, right_hi, right_lo, bottom_lo}}
+  },
+  { // 0202
+    {{4, 4}, {left_lo, bottom_lo, bottom_hi, left_hi, right_lo, top_lo, top_hi, right_hi}},
+    {{8}, {left_lo, top_lo, top_hi, right_hi, right_lo, bottom_lo, bottom_hi, left_hi}},
+    {{4, 4}, {left_lo, top_lo, top_hi, left_hi, right_lo, bottom_lo, bottom_hi, right_hi}}
+  },
+  {{}, {{5}, {bottom_right, bottom_lo, top_lo, top_hi, right_hi}}, {}}, // 0210
+  {{}, {{6}, {bottom_left, left_lo, top_lo, top_hi, right_hi, bottom_right}}, {}}, // 0211
+  { // 0212
+    {{7}, {bottom_right, bottom_hi, left_hi, left_lo, top_lo, top_hi, right_hi}},
+    {{7}, {bottom_right, bottom_hi, left_hi, left_lo, top_lo, top_hi, right_hi}},
+    {{3, 4}, {bottom_right, bottom_hi, right_hi, top_hi, left_hi, left_lo, top_lo}}
+  },
+  {{}, {{4}, {top_lo, top_hi, bottom_hi, bottom_lo}}, {}}, // 0220
+  {{}, {{5}, {bottom_left, left_lo, top_lo, top_hi, bottom_hi}}, {}}, // 0221
+  {{}, {{4}, {top_hi, left_hi, left_lo, top_lo}}, {}}, // 0222
+  {{}, {{3}, {left_lo, top_left, top_lo}}, {}}, // 1000
+  {{}, {{4}, {top_lo, bottom_lo, bottom_left, top_left}}, {}}, // 1001
+  {{}, {{5}, {top_left, top_lo, bottom_lo, bottom_hi, left_hi}}, {}}, // 1002
+  { // 1010
+    {{3, 3}, {top_left, top_lo, left_lo, bottom_right, bottom_lo, right_lo}},
+    {{6}, {top_left, top_lo, right_lo, bottom_right, bottom_lo, left_lo}},
+    {{6}, {top_left, top_lo, right_lo, bottom_right, bottom_lo, left_lo}}
+  },
+  {{}, {{5}, {top_left, top_lo, right_lo, bottom_right, bottom_left}}, {}}, // 1011
+  {{}, {{6}, {top_left, top_lo, right_lo, bottom_right, bottom_hi, left_hi}}, {}}, // 1012
+  { // 1020
+    {{3, 4}, {top_left, top_lo, left_lo, bottom_lo, right_lo, right_hi, bottom_hi}},
+    {{7}, {top_left, top_lo, right_lo, right_hi, bottom_hi, bottom_lo, left_lo}},
+    {{7}, {top_left, top_lo, right_lo, right_hi, bottom_hi, bottom_lo, left_lo}}
+  },
+  {{}, {{6}, {top_left, top_lo, right_lo, right_hi, bottom_hi, bottom_left}}, {}}, // 1021
+  {{}, {{5}, {top_left, top_lo, right_lo, right_hi, left_hi}}, {}}, // 1022
+  {{}, {{4}, {top_left, top_right, right_lo, left_lo}}, {}}, // 1100
+  {{}, {{5}, {top_left, top_right, right_lo, bottom_lo, bottom_left}}, {}}, // 1101
+  {{}, {{6}, {top_left, top_right, right_lo, bottom_lo, bottom_hi, left_hi}}, {}}, // 1102
+  {{}, {{5}, {top_left, top_right, bottom_right, bottom_lo, left_lo}}, {}}, // 1110
+  {{}, {{4}, {top_left, top_right, bottom_right, bottom_left}}, {}}, // 1111
+  {{}, {{5}, {top_left, top_right, bottom_right, bottom_hi, left_hi}}, {}}, // 1112
+  {{}, {{6}, {top_left, top_right, right_hi, bottom_hi, bottom_lo, left_lo}}, {}}, // 1120
+  {{}, {{5}, {top_left, top_right, right_hi, bottom_hi, bottom_left}}, {}}, // 1121
+  {{}, {{4}, {top_left, top_right, right_hi, left_hi}}, {}}, // 1122
+  {{}, {{5}, {top_left, top_hi, right_hi, right_lo, left_lo}}, {}}, // 1200
+  {{}, {{6}, {top_left, top_hi, right_hi, right_lo, bottom_lo, bottom_left}}, {}}, // 1201
+  { // 1202
+    {{7}, {top_left, top_hi, right_hi, right_lo, bottom_lo, bottom_hi, left_hi}},
+    {{7}, {top_left, top_hi, right_hi, right_lo, bottom_lo, bottom_hi, left_hi}},
+    {{3, 4}, {top_left, top_hi, left_hi, bottom_hi, right_hi, right_lo, bottom_lo}}
+  },
+  {{}, {{6}, {top_left, top_hi, right_hi, bottom_right, bottom_lo, left_lo}}, {}}, // 1210
+  {{}, {{5}, {top_left, top_hi, right_hi, bottom_right, bottom_left}}, {}}, // 1211
+  { // 1212
+    {{6}, {top_left, top_hi, right_hi, bottom_right, bottom_hi, left_hi}},
+    {{6}, {top_left, top_hi, right_hi, bottom_right, bottom_hi, left_hi}},
+    {{3, 3}, {top_left, top_hi, left_hi, bottom_right, bottom_hi, right_hi}}
+  },
+  {{}, {{5}, {top_left, top_hi, bottom_hi, bottom_lo, left_lo}}, {}}, // 1220
+  {{}, {{4}, {top_hi, bottom_hi, bottom_left, top_left}}, {}}, // 1221
+  {{}, {{3}, {left_hi, top_left, top_hi}}, {}}, // 1222
+  {{}, {{4}, {top_lo, left_lo, left_hi, top_hi}}, {}}, // 2000
+  {{}, {{5}, {bottom_left, left_hi, top_hi, top_lo, bottom_lo}}, {}}, // 2001
+  {{}, {{4}, {top_hi, top_lo, bottom_lo, bottom_hi}}, {}}, // 2002
+  { // 2010
+    {{3, 4}, {bottom_right, bottom_lo, right_lo, top_lo, left_lo, left_hi, top_hi}},
+    {{7}, {bottom_right, bottom_lo, left_lo, left_hi, top_hi, top_lo, right_lo}},
+    {{7}, {bottom_right, bottom_lo, left_lo, left_hi, top_hi, top_lo, right_lo}}
+  },
+  {{}, {{6}, {bottom_left, left_hi, top_hi, top_lo, right_lo, bottom_right}}, {}}, // 2011
+  {{}, {{5}, {bottom_right, bottom_hi, top_hi, top_lo, right_lo}}, {}}, // 2012
+  { // 2020
+    {{4, 4}, {left_hi, top_hi, top_lo, left_lo, right_hi, bottom_hi, bottom_lo, right_lo}},
+    {{8}, {left_hi, top_hi, top_lo, right_lo, right_hi, bottom_hi, bottom_lo, left_lo}},
+    {{4, 4}, {left_hi, bottom_hi, bottom_lo, left_lo, right_hi, top_hi, top_lo, right_lo}}
+  },
+  { // 2021
+    {{7}, {bottom_left, left_hi, top_hi, top_lo, right_lo, right_hi, bottom_hi}},
+    {{7}, {bottom_left, left_hi, top_hi, top_lo, right_lo, right_hi, bottom_hi}},
+    {{3, 4}, {bottom_left, left_hi, bottom_hi, right_hi, top_hi, top_lo, right_lo}}
+  },
+  {{}, {{4}, {right_hi, top_hi, top_lo, right_lo}}, {}}, // 2022
+  {{}, {{5}, {top_right, right_lo, left_lo, left_hi, top_hi}}, {}}, // 2100
+  {{}, {{6}, {bottom_left, left_hi, top_hi, top_right, right_lo, bottom_lo}}, {}}, // 2101
+  {{}, {{5}, {top_right, right_lo, bottom_lo, bottom_hi, top_hi}}, {}}, // 2102
+  {{}, {{6}, {top_right, bottom_right, bottom_lo, left_lo, left_hi, top_hi}}, {}}, // 2110
+  {{}, {{5}, {bottom_left, left_hi, top_hi, top_right, bottom_right}}, {}}, // 2111
+  {{}, {{4}, {top_hi, top_right, bottom_right, bottom_hi}}, {}}, // 2112
+  { // 2120
+    {{7}, {top_right, right_hi, bottom_hi, bottom_lo, left_lo, left_hi, top_hi}},
+    {{7}, {top_right, right_hi, bottom_hi, bottom_lo, left_lo, left_hi, top_hi}},
+    {{3, 4}, {top_right, right_hi, top_hi, left_hi, bottom_hi, bottom_lo, left_lo}}
+  },
+  { // 2121
+    {{6}, {bottom_left, left_hi, top_hi, top_right, right_hi, bottom_hi}},
+    {{6}, {bottom_left, left_hi, top_hi, top_right, right_hi, bottom_hi}},
+    {{3, 3}, {bottom_left, left_hi, bottom_hi, top_right, right_hi, top_hi}}
+  },
+  {{}, {{3}, {top_hi, top_right, right_hi}}, {}}, // 2122
+  {{}, {{4}, {left_hi, right_hi, right_lo, left_lo}}, {}}, // 2200
+  {{}, {{5}, {bottom_left, left_hi, right_hi, right_lo, bottom_lo}}, {}}, // 2201
+  {{}, {{4}, {bottom_hi, right_hi, right_lo, bottom_lo}}, {}}, // 2202
+  {{}, {{5}, {left_hi, right_hi, bottom_right, bottom_lo, left_lo}}, {}}, // 2210
+  {{}, {{4}, {left_hi, right_hi, bottom_right, bottom_left}}, {}}, // 2211
+  {{}, {{3}, {right_hi, bottom_right, bottom_hi}}, {}}, // 2212
+  {{}, {{4}, {left_hi, bottom_hi, bottom_lo, left_lo}}, {}}, // 2220
+  {{}, {{3}, {left_hi, bottom_hi, bottom_left}}, {}}, // 2221
+  {{}, {}, {}}, // 2222
+};
+
+// the line segments of a cell: at most two, each from one cell vertex to another
+struct cell_lines {
+  unsigned char size; // number of segments
+  cell_vertex from[2], to[2];
+};
+
+// line segments of the cells with binary index 0 to 15; the digits of the index,
+// given in the comments, tell whether the top left, top right, bottom right, and
+// bottom left corners are at or above the isoline (1) or not (0). The saddles 5
+// and 10 are drawn as given when their central value is at or above the isoline,
+// and the other way round otherwise, see isoliner::saddle_index().
+constexpr cell_lines line_segments[16] = {
+  {0, {}, {}}, // 0000
+  {1, {left_lo}, {bottom_lo}}, // 0001
+  {1, {right_lo}, {bottom_lo}}, // 0010
+  {1, {left_lo}, {right_lo}}, // 0011
+  {1, {top_lo}, {right_lo}}, // 0100
+  {2, {right_lo, top_lo}, {bottom_lo, left_lo}}, // 0101
+  {1, {top_lo}, {bottom_lo}}, // 0110
+  {1, {top_lo}, {left_lo}}, // 0111
+  {1, {top_lo}, {left_lo}}, // 1000
+  {1, {top_lo}, {bottom_lo}}, // 1001
+  {2, {left_lo, top_lo}, {bottom_lo, right_lo}}, // 1010
+  {1, {top_lo}, {right_lo}}, // 1011
+  {1, {left_lo}, {right_lo}}, // 1100
+  {1, {right_lo}, {bottom_lo}}, // 1101
+  {1, {left_lo}, {bottom_lo}}, // 1110
+  {0, {}, {}} // 1111
+};
+
+struct strip_topology; // see calculate_strip()
+
+// summary statistics of the contour at one level, see isobander::calculate_stats()
+struct contour_stats {
+  double area = 0, length = 0; // band area and perimeter, or line length
+  double cells = 0; // cells the contour passes through
+  double boundary_cells = 0; // of these, cells crossed by the boundary of a band
+};
+
+// Polygon rings or lines with fewer than min_vertices vertices, or enclosing an
+// area below min_area, are left out of the output, see isobander::select_paths()
+struct path_filter {
+  double min_area = 0;
+  int min_vertices = 0;
+
+  bool active() const {return min_area > 0 || min_vertices > 0;}
+
+  bool operator!=(const path_filter &f) const {return min_area != f.min_area || min_vertices != f.min_vertices;}
+};
+
+// the size and extent of a path, measured while counting the vertices of the paths
+// to be collected when they are filtered. The vertices themselves are only kept
+// while there are fewer than max_points of them.
+struct path_shape : path_measure {
+  R_xlen_t n = 0; // number of vertices
+  bool closed = true; // for lines, whether they end where they start
+  point second;
+  polygon points;
+
+  void add(const point &p, int max_points) {
+    path_measure::add(p);
+    if (n == 1) second = p;
+    if (n < max_points) {
+      points.push_back(p);
+    } else if (n == max_points) {
+      polygon().swap(points);
+    }
+    n++;
+  }
+};
+
 class isobander {
 protected:
   int nrow, ncol; // numbers of rows and columns
   cpp11::doubles grid_x, grid_y;
-  cpp11::doubles_matrix<> grid_z;
-  double *grid_x_p, *grid_y_p, *grid_z_p;
+  cpp11::sexp grid_z;
+  double *grid_x_p, *grid_y_p;
+  // grid values of type z_type, column by column, starting at grid row z_row0; usually
+  // that's the whole grid, but when streaming only the rows currently being contoured
+  const void *grid_z_p;
+  value_type z_type;
+  int z_row0, z_stride; // first grid row and distance between columns in grid_z_p
   double vlo, vhi; // low and high cutoff values
   grid_point tmp_poly[8]; // temp storage for elementary polygons; none has more than 8 vertices
+  int tmp_poly_index[8]; // point store entries of the points in tmp_poly
   point_connect tmp_point_connect[8];
   int tmp_poly_size; // current number of elements in tmp_poly
 
-  typedef unordered_map<grid_point, point_connect, grid_point_hasher> gridmap;
-  gridmap polygon_grid;
+  grid_store polygon_grid;
+
+  // classes of the grid points to the left and right of the current cell column
+  // (see classify_points()), and the resulting cell codes; kept from one level
+  // to the next so that contouring a level doesn't allocate anything here
+  vector<unsigned char> left_class, right_class, cell_codes;
+
+  // optional value ranges of the grid tiles, for skipping tiles without contour
+  const grid_ranges *ranges;
+
+  // when streaming, point coordinates are calculated as soon as the points are
+  // created, while their grid values are still around; indexed by store entry
+  bool keep_coords;
+  vector<point> point_coords;
+
+  // in a sweep over several bands, the coordinates of the boundary crossings
+  // are kept in point_coords too, and those at vlo are copied from band_below,
+  // the band whose high cutoff is vlo, when it has them, see lookup_point()
+  bool keep_crossings = false;
+  const isobander *band_below = nullptr;
+  int open_points = 0; // points left in the store by the last collect_finished()
+
+  // paths left out when collecting, and whether each path found by trace_paths()
+  // is kept; empty if all are
+  path_filter filter;
+  vector<char> path_kept;
+
+  // whether the paths are measured as they are collected, into metrics
+  bool measure_paths = false;
+  path_metrics metrics;
+
+  // whether the outer ring of each polygon ring is added to the output, see collect()
+  bool record_parents = false;
+
+  // if not null, the cell rows touched by each path are recorded here as
+  // the paths are collected
+  path_rows *traced_rows = nullptr;
+
+  // if not null, the outer ring of each polygon ring is recorded here as the
+  // rings are collected, see find_parents()
+  vector<int> *traced_parents = nullptr;
 
   bool interrupted;
+  bool r_api; // whether we may call into R; false when running on a worker thread
+
+  friend class isoband_sweeper;
+  template <class T> friend void calculate_contour_strips(T &, int);
+  template <class T> friend void calculate_strip(T &, const vector<int> &, int, strip_topology &);
+  template <class T> friend void join_strips(T &, const vector<int> &, vector<strip_topology> &, bool, const vector<char> *);
+
+  void check_interrupt() {
+    if (r_api) cpp11::check_user_interrupt();
+  }
+
+  // off the main thread, errors are thrown as C++ exceptions and
+  // raised in R once they have been passed back to the main thread
+  void stop(const char *msg) {
+    if (r_api) cpp11::stop("%s", msg);
+    throw runtime_error(msg);
+  }
+
+  // the same with a message formatted from fmt and its arguments
+  template <typename Arg, typename... Args>
+  void stop(const char *fmt, Arg arg, Args... args) {
+    char msg[256];
+    snprintf(msg, sizeof(msg), fmt, arg, args...);
+    stop(msg);
+  }
 
   void reset_grid() {
     polygon_grid.clear();
+    open_points = 0;
 
     for (int i=0; i<8; i++) {
       tmp_point_connect[i] = point_connect();
@@ -105,16 +846,67 @@ protected:
 
   // internal member functions
 
+  template <class T>
+  const T *z_ptr(int r, int c) const {// location of the value of grid point (r, c)
+    return static_cast<const T *>(grid_z_p) + (r - z_row0) + (ptrdiff_t)c * z_stride;
+  }
+
+  double z_at(int r, int c) const {
+    switch (z_type) {
+    case values_float: return value_traits<float>::as_double(*z_ptr<float>(r, c));
+    case values_int32: return value_traits<int32_t>::as_double(*z_ptr<int32_t>(r, c));
+    case values_int16: return value_traits<int16_t>::as_double(*z_ptr<int16_t>(r, c));
+    default: return *z_ptr<double>(r, c);
+    }
+  }
+
+  // classifies the n grid points (r0, c), ..., (r0 + n - 1, c), see classify_points()
+  void classify_column(int r0, int c, int n, double lo, double hi, unsigned char *out) const {
+    switch (z_type) {
+    case values_float: classify_points(z_ptr<float>(r0, c), n, lo, hi, out); break;
+    case values_int32: classify_points(z_ptr<int32_t>(r0, c), n, lo, hi, out); break;
+    case values_int16: classify_points(z_ptr<int16_t>(r0, c), n, lo, hi, out); break;
+    default: classify_points(z_ptr<double>(r0, c), n, lo, hi, out);
+    }
+  }
+
   double central_value(int r, int c) {// calculates the central value of a given cell
-    return (grid_z_p[r + c * nrow] + grid_z_p[r + (c + 1) * nrow] + grid_z_p[r + 1 + c * nrow] + grid_z_p[r + 1 + (c + 1) * nrow])/4;
+    return (z_at(r, c) + z_at(r, c + 1) + z_at(r + 1, c) + z_at(r + 1, c + 1))/4;
   }
 
-  void poly_start(int r, int c, point_type type) { // start a new elementary polygon
-    tmp_poly[0].r = r;
-    tmp_poly[0].c = c;
-    tmp_poly[0].type = type;
+  // looks up (or creates) the store entry for grid point p, see grid_store::lookup()
+  int lookup_point(const grid_point &p, bool &existed) {
+    int i = polygon_grid.lookup(p, existed);
+    if (keep_coords && !existed) {
+      if (i >= (int)point_coords.size()) point_coords.resize(i + 1);
+      point_coords[i] = calc_point_coords(p);
+    } else if (keep_crossings && !existed && p.type != grid) {
+      if (i >= (int)point_coords.size()) point_coords.resize(i + 1);
+      // band_below is swept in step with this band and has just seen the
+      // same cell, so its crossing on the same edge is still in its window
+      int j = -1;
+      if (band_below && (p.type == hintersect_lo || p.type == vintersect_lo)) {
+        point_type type_hi = (p.type == hintersect_lo) ? hintersect_hi : vintersect_hi;
+        j = band_below->polygon_grid.find(grid_point(p.r, p.c, type_hi));
+      }
+      point_coords[i] = (j >= 0) ? band_below->point_coords[j] : calc_point_coords(p);
+    }
+    return i;
+  }
 
-    tmp_poly_size = 1;
+  point coords_of(int i) {
+    if (keep_coords) return point_coords[i];
+    const grid_point &p = polygon_grid.point_at(i);
+    return (keep_crossings && p.type != grid) ? point_coords[i] : calc_point_coords(p);
+  }
+
+  // widens r_first to r_last to the cell rows bordering store entry i: the
+  // row holding its vertical edge, or the rows above and below its grid row
+  void add_cell_rows(int i, int &r_first, int &r_last) {
+    const grid_point &p = polygon_grid.point_at(i);
+    bool vertical = (p.type == vintersect_lo || p.type == vintersect_hi);
+    r_first = min(r_first, vertical ? p.r : p.r - 1);
+    r_last = max(r_last, p.r);
   }
 
   void poly_add(int r, int c, point_type type) { // add point to elementary polygon
@@ -129,99 +921,131 @@ protected:
     //cout << "before merging:" << endl;
 
     bool to_delete[] = {false, false, false, false, false, false, false, false};
+    bool existed[8];
+
+    // the region of the band the current polygon belongs to: that of the first
+    // polygon it is merged with along an edge, joined with those of any others,
+    // or a new one if there are none. Connections taking on the current region
+    // get region -1 until it is known.
+    int region = -1;
+    auto merge_region = [&](int other) {
+      region = (region < 0) ? polygon_grid.find_region(other) : polygon_grid.join_regions(region, other);
+    };
+
+    // look up (or create) the store entries for all points in the current polygon
+    for (int i = 0; i < tmp_poly_size; i++) {
+      tmp_poly_index[i] = lookup_point(tmp_poly[i], existed[i]);
+    }
 
     // first, we figure out the right connections for current polygon
     for (int i = 0; i < tmp_poly_size; i++) {
       // create defined state in tmp_point_connect[]
       // for each point, find previous and next point in polygon
       tmp_point_connect[i].altpoint = false;
-      tmp_point_connect[i].next = tmp_poly[(i+1<tmp_poly_size) ? i+1 : 0];
-      tmp_point_connect[i].prev = tmp_poly[(i-1>=0) ? i-1 : tmp_poly_size-1];
+      tmp_point_connect[i].next = tmp_poly_index[(i+1<tmp_poly_size) ? i+1 : 0];
+      tmp_point_connect[i].prev = tmp_poly_index[(i-1>=0) ? i-1 : tmp_poly_size-1];
+      tmp_point_connect[i].region = tmp_point_connect[i].region2 = -1;
 
       //cout << tmp_poly[i] << ": " << tmp_point_connect[i] << endl;
 
       // now merge with existing polygons if needed
-      const grid_point &p = tmp_poly[i];
-      if (polygon_grid.count(p) > 0) { // point has been used before, need to merge polygons
-        if (!polygon_grid[p].altpoint) {
+      const point_connect &pc = polygon_grid[tmp_poly_index[i]];
+      if (existed[i]) { // point has been used before, need to merge polygons
+        if (!pc.altpoint) {
           // basic scenario, no alternative point at this location
-          int score = 2 * (tmp_point_connect[i].next == polygon_grid[p].prev) + (tmp_point_connect[i].prev == polygon_grid[p].next);
+          int score = 2 * (tmp_point_connect[i].next == pc.prev) + (tmp_point_connect[i].prev == pc.next);
           switch (score) {
           case 3: // 11
             // both prev and next cancel, point can be deleted
             to_delete[i] = true;
+            merge_region(pc.region);
             break;
           case 2: // 10
             // merge in "next" direction
-            tmp_point_connect[i].next = polygon_grid[p].next;
+            tmp_point_connect[i].next = pc.next;
+            merge_region(pc.region);
             break;
           case 1: // 01
             // merge in "prev" direction
-            tmp_point_connect[i].prev = polygon_grid[p].prev;
+            tmp_point_connect[i].prev = pc.prev;
+            merge_region(pc.region);
             break;
           default: // 00
             // if we get here, we have two polygon vertices sharing the same grid location
             // in an unmergable configuration; need to store both
-            tmp_point_connect[i].prev2 = polygon_grid[p].prev;
-            tmp_point_connect[i].next2 = polygon_grid[p].next;
+            tmp_point_connect[i].prev2 = pc.prev;
+            tmp_point_connect[i].next2 = pc.next;
+            tmp_point_connect[i].region2 = pc.region;
             tmp_point_connect[i].altpoint = true;
           }
         } else {
           // case with alternative point at this location
           int score =
-            8 * (tmp_point_connect[i].next == polygon_grid[p].prev2) + 4 * (tmp_point_connect[i].prev == polygon_grid[p].next2) +
-            2 * (tmp_point_connect[i].next == polygon_grid[p].prev) + (tmp_point_connect[i].prev == polygon_grid[p].next);
+            8 * (tmp_point_connect[i].next == pc.prev2) + 4 * (tmp_point_connect[i].prev == pc.next2) +
+            2 * (tmp_point_connect[i].next == pc.prev) + (tmp_point_connect[i].prev == pc.next);
           switch (score) {
           case 9: // 1001
             // three-way merge
-            tmp_point_connect[i].next = polygon_grid[p].next2;
-            tmp_point_connect[i].prev = polygon_grid[p].prev;
+            tmp_point_connect[i].next = pc.next2;
+            tmp_point_connect[i].prev = pc.prev;
+            merge_region(pc.region);
+            merge_region(pc.region2);
             break;
           case 6: // 0110
             // three-way merge
-            tmp_point_connect[i].next = polygon_grid[p].next;
-            tmp_point_connect[i].prev = polygon_grid[p].prev2;
+            tmp_point_connect[i].next = pc.next;
+            tmp_point_connect[i].prev = pc.prev2;
+            merge_region(pc.region);
+            merge_region(pc.region2);
             break;
           case 8: // 1000
             // two-way merge with alt point only
             // set up merged alt point
-            tmp_point_connect[i].next2 = polygon_grid[p].next2;
+            tmp_point_connect[i].next2 = pc.next2;
             tmp_point_connect[i].prev2 = tmp_point_connect[i].prev;
+            merge_region(pc.region2);
             // copy over existing point as is
-            tmp_point_connect[i].prev = polygon_grid[p].prev;
-            tmp_point_connect[i].next = polygon_grid[p].next;
+            tmp_point_connect[i].prev = pc.prev;
+            tmp_point_connect[i].next = pc.next;
+            tmp_point_connect[i].region = pc.region;
             tmp_point_connect[i].altpoint = true;
             break;
           case 4: // 0100
             // two-way merge with alt point only
             // set up merged alt point
-            tmp_point_connect[i].prev2 = polygon_grid[p].prev2;
+            tmp_point_connect[i].prev2 = pc.prev2;
             tmp_point_connect[i].next2 = tmp_point_connect[i].next;
+            merge_region(pc.region2);
             // copy over existing point as is
-            tmp_point_connect[i].prev = polygon_grid[p].prev;
-            tmp_point_connect[i].next = polygon_grid[p].next;
+            tmp_point_connect[i].prev = pc.prev;
+            tmp_point_connect[i].next = pc.next;
+            tmp_point_connect[i].region = pc.region;
             tmp_point_connect[i].altpoint = true;
             break;
           case 2: // 0010
             // two-way merge with original point only
             // merge point
-            tmp_point_connect[i].next = polygon_grid[p].next;
+            tmp_point_connect[i].next = pc.next;
+            merge_region(pc.region);
             // copy over existing alt point as is
-            tmp_point_connect[i].prev2 = polygon_grid[p].prev2;
-            tmp_point_connect[i].next2 = polygon_grid[p].next2;
+            tmp_point_connect[i].prev2 = pc.prev2;
+            tmp_point_connect[i].next2 = pc.next2;
+            tmp_point_connect[i].region2 = pc.region2;
             tmp_point_connect[i].altpoint = true;
             break;
           case 1: // 0100
             // two-way merge with original point only
             // merge point
-            tmp_point_connect[i].prev = polygon_grid[p].prev;
+            tmp_point_connect[i].prev = pc.prev;
+            merge_region(pc.region);
             // copy over existing alt point as is
-            tmp_point_connect[i].prev2 = polygon_grid[p].prev2;
-            tmp_point_connect[i].next2 = polygon_grid[p].next2;
+            tmp_point_connect[i].prev2 = pc.prev2;
+            tmp_point_connect[i].next2 = pc.next2;
+            tmp_point_connect[i].region2 = pc.region2;
             tmp_point_connect[i].altpoint = true;
             break;
           default:
-            cpp11::stop("undefined merging configuration: %i\n", score);
+            stop("undefined merging configuration: %i\n", score);
           }
         }
       }
@@ -229,14 +1053,17 @@ protected:
 
     //cout << "after merging:" << endl;
 
+    if (region < 0) region = polygon_grid.add_region();
+
     // then we copy the connections into the polygon matrix
     for (int i = 0; i < tmp_poly_size; i++) {
-      const grid_point &p = tmp_poly[i];
-
       if (to_delete[i]) { // delete point if needed
-        polygon_grid.erase(p);
+        polygon_grid.erase(tmp_poly_index[i]);
       } else {            // otherwise, copy
-        polygon_grid[p] = tmp_point_connect[i];
+        point_connect &pc = tmp_point_connect[i];
+        if (pc.region < 0) pc.region = region;
+        if (pc.altpoint && pc.region2 < 0) pc.region2 = region;
+        polygon_grid[tmp_poly_index[i]] = pc;
       }
       //cout << p << ": " << tmp_point_connect[i] << endl;
     }
@@ -247,14 +1074,24 @@ protected:
 
 
   void print_polygons_state() {
-    for (auto it = polygon_grid.begin(); it != polygon_grid.end(); it++) {
-      cout << it->first << ": " << it->second << endl;
+    for (int i = 0; i < polygon_grid.size(); i++) {
+      if (polygon_grid.in_use(i)) {
+        cout << i << " " << polygon_grid.point_at(i) << ": " << polygon_grid[i] << endl;
+      }
     }
     cout << endl;
   }
 
 
   // linear interpolation of boundary intersections
+  //
+  // A crossing is always computed from the edge's two end points in grid order
+  // and the level, never from the direction in which a polygon walks the edge.
+  // The upper boundary of one band and the lower boundary of the next band, as
+  // well as the isoline at the same level, therefore get bit-identical
+  // coordinates, and adjacent bands meet without gaps or slivers. When the
+  // bands are swept together, each such crossing is only interpolated once,
+  // see lookup_point().
   double interpolate(double x0, double x1, double z0, double z1, double value) {
     double d = (value - z0) / (z1 - z0);
     double x = x0 + d * (x1 - x0);
@@ -267,1024 +1104,569 @@ protected:
     case grid:
       return point(grid_x_p[p.c], grid_y_p[p.r]);
     case hintersect_lo: // intersection with horizontal edge, low value
-      return point(interpolate(grid_x_p[p.c], grid_x_p[p.c+1], grid_z_p[p.r + p.c * nrow], grid_z_p[p.r + (p.c + 1) * nrow], vlo), grid_y_p[p.r]);
+      return point(interpolate(grid_x_p[p.c], grid_x_p[p.c+1], z_at(p.r, p.c), z_at(p.r, p.c + 1), vlo), grid_y_p[p.r]);
     case hintersect_hi: // intersection with horizontal edge, high value
-      return point(interpolate(grid_x_p[p.c], grid_x_p[p.c+1], grid_z_p[p.r + p.c * nrow], grid_z_p[p.r + (p.c + 1) * nrow], vhi), grid_y_p[p.r]);
+      return point(interpolate(grid_x_p[p.c], grid_x_p[p.c+1], z_at(p.r, p.c), z_at(p.r, p.c + 1), vhi), grid_y_p[p.r]);
     case vintersect_lo: // intersection with vertical edge, low value
-      return point(grid_x_p[p.c], interpolate(grid_y_p[p.r], grid_y_p[p.r+1], grid_z_p[p.r + p.c * nrow], grid_z_p[p.r + 1 + p.c * nrow], vlo));
+      return point(grid_x_p[p.c], interpolate(grid_y_p[p.r], grid_y_p[p.r+1], z_at(p.r, p.c), z_at(p.r + 1, p.c), vlo));
     case vintersect_hi: // intersection with vertical edge, high value
-      return point(grid_x_p[p.c], interpolate(grid_y_p[p.r], grid_y_p[p.r+1], grid_z_p[p.r + p.c * nrow], grid_z_p[p.r + 1 + p.c * nrow], vhi));
+      return point(grid_x_p[p.c], interpolate(grid_y_p[p.r], grid_y_p[p.r+1], z_at(p.r, p.c), z_at(p.r + 1, p.c), vhi));
     default:
       return point(0, 0); // should never get here
     }
   }
 
+  // the variant of the elementary polygons of cell (r, c) with ternary index
+  // `index`: for saddles 0, 1, or 2, depending on the central value; 1 otherwise
+  int polygon_variant(int r, int c, int index) {
+    if (band_polygons[index][0].size[0] == 0) return 1;
+    double vc = central_value(r, c);
+    return (vc < vlo) ? 0 : (vc >= vhi) ? 2 : 1;
+  }
+
+  // merges the elementary polygons of cell (r, c) with ternary index `index`
+  // into the polygon grid, see band_polygons
+  void elementary_polygons(int r, int c, int index) {
+    const cell_polygons &polys = band_polygons[index][polygon_variant(r, c, index)];
+    const cell_vertex *v = polys.vertex;
+    for (int k = 0; k < 2 && polys.size[k] > 0; k++) {
+      tmp_poly_size = 0;
+      for (int i = 0; i < polys.size[k]; i++, v++) {
+        const vertex_offset &p = cell_vertex_points[*v];
+        poly_add(r + p.dr, c + p.dc, p.type);
+      }
+      poly_merge();
+    }
+  }
+
+  // output coordinates of cell vertex v of cell (r, c)
+  point vertex_coords(int r, int c, cell_vertex v) {
+    const vertex_offset &p = cell_vertex_points[v];
+    return calc_point_coords(grid_point(r + p.dr, c + p.dc, p.type));
+  }
+
+  // whether the given side of cell (r, c) borders a cell without contour because
+  // it lies outside the grid or has an NA corner; an edge of an elementary
+  // polygon along such a side isn't merged away, and so is part of the outline
+  bool open_side(int r, int c, cell_side side) const {
+    switch (side) {
+    case top_side: return r == 0 || !R_finite(z_at(r - 1, c)) || !R_finite(z_at(r - 1, c + 1));
+    case right_side: return c + 2 == ncol || !R_finite(z_at(r, c + 2)) || !R_finite(z_at(r + 1, c + 2));
+    case bottom_side: return r + 2 == nrow || !R_finite(z_at(r + 2, c)) || !R_finite(z_at(r + 2, c + 1));
+    default: return c == 0 || !R_finite(z_at(r, c - 1)) || !R_finite(z_at(r + 1, c - 1));
+    }
+  }
+
 public:
-  isobander(cpp11::doubles x, cpp11::doubles y, cpp11::doubles_matrix<> z, double value_low = 0, double value_high = 0) :
-    grid_x(x), grid_y(y), grid_z(z), grid_x_p(REAL(x)), grid_y_p(REAL(y)),
-    grid_z_p(REAL(z)), vlo(value_low), vhi(value_high), interrupted(false)
+  // z is a double or integer matrix, see check_grid_matrix()
+  isobander(cpp11::doubles x, cpp11::doubles y, cpp11::sexp z, double value_low = 0, double value_high = 0) :
+    isobander(x, y, Rf_nrows(z), Rf_ncols(z), value_low, value_high)
   {
-    nrow = grid_z.nrow();
-    ncol = grid_z.ncol();
+    grid_z = z;
+    grid_z_p = matrix_values(z);
+    z_type = matrix_value_type(z);
+  }
 
+  // for a grid of nrow x ncol values that are supplied later, see set_grid_rows()
+  isobander(cpp11::doubles x, cpp11::doubles y, int nrow_in, int ncol_in, double value_low = 0, double value_high = 0) :
+    nrow(nrow_in), ncol(ncol_in), grid_x(x), grid_y(y), grid_x_p(REAL(x)), grid_y_p(REAL(y)),
+    grid_z_p(nullptr), z_type(values_double), z_row0(0), z_stride(nrow_in), vlo(value_low), vhi(value_high),
+    ranges(nullptr), keep_coords(false), interrupted(false), r_api(true)
+  {
     if (grid_x.size() != ncol) {cpp11::stop("Number of x coordinates must match number of columns in density matrix.");}
     if (grid_y.size() != nrow) {cpp11::stop("Number of y coordinates must match number of rows in density matrix.");}
+
+    polygon_grid = grid_store(ncol);
+    left_class.resize(grid_store::block_rows + 1);
+    right_class.resize(grid_store::block_rows + 1);
+    cell_codes.resize(grid_store::block_rows);
   }
 
   virtual ~isobander() {}
 
   bool was_interrupted() {return interrupted;}
 
+  // must be set to false before the contour is calculated or collected on a worker thread
+  void set_r_api(bool allowed) {r_api = allowed;}
+
+  // lets the contour calculations skip tiles of the grid; the ranges must belong
+  // to the grid values and outlive the calculations, or be null for no skipping
+  void set_grid_ranges(const grid_ranges *r) {ranges = r;}
+
+  // leaves the polygon rings or lines selected by f out when collecting
+  void set_path_filter(const path_filter &f) {filter = f;}
+
+  // adds the area, length, and bounding box of every collected path to the
+  // output, see collect()
+  void set_measure_paths(bool measure) {measure_paths = measure;}
+
+  // adds the id of the outer ring of every collected polygon ring to the
+  // output, see collect(); isoliners have no rings and ignore this
+  void set_record_parents(bool record) {record_parents = record;}
+
+  // replaces the grid values by those of z, which must have the same
+  // dimensions and type
+  void set_grid_values(cpp11::sexp z) {
+    grid_z = z;
+    grid_z_p = matrix_values(z);
+  }
+
+  // replaces the grid values by the nrow x ncol values of the given type at z,
+  // which the caller keeps alive; unlike set_grid_values(), this doesn't touch
+  // any R objects
+  void set_grid_pointer(const void *z, value_type type) {
+    grid_z_p = z;
+    z_type = type;
+  }
+
+  // switches to another grid of nrow_in x ncol_in values of the given type at z,
+  // with coordinates x and y, all of which the caller keeps alive; doesn't touch
+  // any R objects, so that a worker can go through many grids
+  void set_grid(const double *x, const double *y, int nrow_in, int ncol_in, const void *z, value_type type) {
+    if (ncol_in != ncol) polygon_grid = grid_store(ncol_in);
+    nrow = nrow_in;
+    ncol = ncol_in;
+    grid_x_p = const_cast<double *>(x);
+    grid_y_p = const_cast<double *>(y);
+    grid_z_p = z;
+    z_type = type;
+    z_row0 = 0;
+    z_stride = nrow_in;
+  }
+
   void set_value(double value_low, double value_high) {
     vlo = value_low;
     vhi = value_high;
   }
 
-  virtual void calculate_contour() {
+  void calculate_contour() {
     // clear polygon grid and associated internal variables
     reset_grid();
 
-    // setup matrix of ternarized cell representations
-    vector<int> ternarized(nrow*ncol);
-    vector<int>::iterator iv = ternarized.begin();
-    for (int i = 0; i < nrow * ncol; ++i) {
-      *iv = (grid_z_p[i] >= vlo && grid_z_p[i] < vhi) + 2*(grid_z_p[i] >= vhi);
-      iv++;
+    calculate_rows(0, nrow - 1);
+  }
+
+  // classifies the cells in the cell rows r_first, ..., r_last-1 and calls
+  // process(r, c, code) for each of them, with the cell codes of combine_cells()
+  // for grid points classified against vlo and hi. The grid is stored column by
+  // column, so we work down one column of cells at a time, in blocks of rows
+  // (see grid_store). With grid ranges, the column of a block is split along
+  // the tile boundaries, and cells in tiles without values at or above vlo and
+  // below tile_hi are left out; the classes of the left grid column are only
+  // carried over for pieces that weren't left out in the previous column.
+  template <class F>
+  void process_cells(int r_first, int r_last, double hi, int base, double tile_hi, F process) {
+    unsigned char *cells = cell_codes.data();
+    const int max_pieces = grid_store::block_rows / grid_ranges::tile_size + 1;
+    int piece[max_pieces + 1]; // first cell row of each piece, and the end of the block
+    bool left_valid[max_pieces];
+
+    for (int r0 = r_first; r0 < r_last; r0 += grid_store::block_rows) {
+      int n = min(grid_store::block_rows, r_last - r0); // number of cell rows in the block
+      polygon_grid.start_block(r0, r0 + n);
+
+      int n_pieces = 0;
+      for (int r = r0; r < r0 + n; n_pieces++) {
+        piece[n_pieces] = r;
+        left_valid[n_pieces] = false;
+        r = ranges ? min(r0 + n, (r / grid_ranges::tile_size + 1) * grid_ranges::tile_size) : r0 + n;
+      }
+      piece[n_pieces] = r0 + n;
+
+      for (int c = 0; c < ncol - 1; c++) {
+        polygon_grid.advance(c);
+        for (int k = 0; k < n_pieces; k++) {
+          int r = piece[k], m = piece[k+1] - r, i0 = r - r0;
+          if (ranges && !ranges->overlaps(r, c, vlo, tile_hi)) {
+            left_valid[k] = false;
+            continue;
+          }
+          if (!left_valid[k]) classify_column(r, c, m + 1, vlo, hi, left_class.data() + i0);
+          classify_column(r, c + 1, m + 1, vlo, hi, right_class.data() + i0);
+          combine_cells(left_class.data() + i0, right_class.data() + i0, m, base, cells + i0);
+          for (int i = i0; i < i0 + m; i++) {
+            process(r0 + i, c, cells[i]);
+          }
+          left_valid[k] = true;
+        }
+        left_class.swap(right_class);
+      }
+      check_interrupt();
     }
+  }
 
-    vector<int> cells((nrow - 1) * (ncol - 1));
+  // processes the cell rows r_first, ..., r_last-1, adding their elementary
+  // polygons to whatever is in the polygon grid already
+  virtual void calculate_rows(int r_first, int r_last) {
+    process_cells(r_first, r_last, vhi, 3, vhi, [this](int r, int c, int index) {
+      // cells entirely below or above the band, or with an NA corner, have no contour
+      if (index == 0 || index == 80) return;
+      // all polygons must be drawn clockwise for proper merging
+      elementary_polygons(r, c, index);
+    });
+  }
 
-    for (int r = 0; r < nrow-1; r++) {
-      for (int c = 0; c < ncol-1; c++) {
-        int index;
-        if (!R_finite(grid_z_p[r + c * nrow]) || !R_finite(grid_z_p[r + (c + 1) * nrow]) ||
-            !R_finite(grid_z_p[r + 1 + c * nrow]) || !R_finite(grid_z_p[r + 1 + (c + 1) * nrow])) {
-          // we don't draw any contours if at least one of the corners is NA
-          index = 0;
-        } else {
-          index = 27*ternarized[r + c * nrow] + 9*ternarized[r + (c + 1) * nrow] + 3*ternarized[r + 1 + (c + 1) * nrow] + ternarized[r + 1 + c * nrow];
+  // stores the codes of the cells in the cell rows r_first, ..., r_last-1 in
+  // codes, column by column, with the variant of saddles folded in. Cells with
+  // the same codes get the same elementary polygons, whatever their grid values;
+  // only the coordinates of the points differ. Cells in tiles left out by the
+  // grid ranges are not touched.
+  virtual void row_codes(int r_first, int r_last, unsigned char *codes) {
+    int n = r_last - r_first;
+    process_cells(r_first, r_last, vhi, 3, vhi, [&](int r, int c, int index) {
+      codes[(ptrdiff_t)c * n + r - r_first] = index + 81 * polygon_variant(r, c, index);
+    });
+  }
+
+  // calculates the area, perimeter, and cell counts of the band from the
+  // elementary polygons of each cell, without merging or storing them. The
+  // elementary polygons don't overlap, so their areas add up to that of the
+  // band, and the outline consists of the polygon edges that aren't shared
+  // with a neighboring cell: those running through the interior of the cell,
+  // and those along an open side, see open_side().
+  virtual contour_stats calculate_stats() {
+    reset_grid();
+    contour_stats stats;
+    process_cells(0, nrow - 1, vhi, 3, vhi, [&](int r, int c, int index) {
+      if (index == 0 || index == 80) return;
+      stats.cells++;
+      if (index == 40) { // the whole cell is in the band
+        double w = fabs(grid_x_p[c + 1] - grid_x_p[c]), h = fabs(grid_y_p[r + 1] - grid_y_p[r]);
+        stats.area += w * h;
+        stats.length += (open_side(r, c, top_side) + open_side(r, c, bottom_side)) * w +
+          (open_side(r, c, left_side) + open_side(r, c, right_side)) * h;
+        return;
+      }
+      stats.boundary_cells++;
+
+      const cell_polygons &polys = band_polygons[index][polygon_variant(r, c, index)];
+      const cell_vertex *v = polys.vertex;
+      for (int k = 0; k < 2 && polys.size[k] > 0; k++) {
+        int n = polys.size[k];
+        point p[8];
+        for (int i = 0; i < n; i++) p[i] = vertex_coords(r, c, v[i]);
+
+        double area2 = 0; // twice the signed area
+        for (int i = 0, j = n - 1; i < n; j = i++) {
+          area2 += (p[j].x + p[i].x) * (p[j].y - p[i].y);
+          int shared = cell_vertex_sides[v[j]] & cell_vertex_sides[v[i]];
+          if (!shared || open_side(r, c, static_cast<cell_side>(shared))) {
+            stats.length += hypot(p[i].x - p[j].x, p[i].y - p[j].y);
+          }
         }
-        cells[r + c * (nrow - 1)] = index;
-        //cout << index << " ";
+        stats.area += fabs(area2) / 2;
+        v += n;
       }
-      //cout << endl;
+    });
+    return stats;
+  }
+
+  bool may_have_contour(int r, int c) const {
+    return !ranges || ranges->overlaps(r, c, vlo, vhi);
+  }
+
+  // classifies and processes a single cell; used for the cell rows
+  // along the seams between strips, see join_strips()
+  virtual int cell_index(int r, int c) {
+    double z[4] = {z_at(r, c), z_at(r, c + 1), z_at(r + 1, c + 1), z_at(r + 1, c)};
+    int index = 0;
+    for (int k = 0; k < 4; k++) {
+      if (!R_finite(z[k])) return 0;
+      index = 3*index + (z[k] >= vlo && z[k] < vhi) + 2*(z[k] >= vhi);
     }
-    cpp11::check_user_interrupt();
+    return index;
+  }
 
-    // all polygons must be drawn clockwise for proper merging
-    for (int r = 0; r < nrow-1; r++) {
-      for (int c = 0; c < ncol-1; c++) {
-        //cout << r << " " << c << " " << cells(r, c) << endl;
-        switch(cells[r + c * (nrow - 1)]) {
-        // doing cases out of order, sorted by type, is easier to keep track of
-
-        // no contour
-        case 0: break;
-        case 80: break;
-
-        // single triangle
-        case 1: // 0001
-          poly_start(r, c, vintersect_lo);
-          poly_add(r+1, c, hintersect_lo);
-          poly_add(r+1, c, grid);
-          poly_merge();
-          break;
-        case 3: // 0010
-          poly_start(r, c+1, vintersect_lo);
-          poly_add(r+1, c+1, grid);
-          poly_add(r+1, c, hintersect_lo);
-          poly_merge();
-          break;
-        case 9: // 0100
-          poly_start(r, c, hintersect_lo);
-          poly_add(r, c+1, grid);
-          poly_add(r, c+1, vintersect_lo);
-          poly_merge();
-          break;
-        case 27: // 1000
-          poly_start(r, c, vintersect_lo);
-          poly_add(r, c, grid);
-          poly_add(r, c, hintersect_lo);
-          poly_merge();
-          break;
-        case 79: // 2221
-          poly_start(r, c, vintersect_hi);
-          poly_add(r+1, c, hintersect_hi);
-          poly_add(r+1, c, grid);
-          poly_merge();
-          break;
-        case 77: // 2212
-          poly_start(r, c+1, vintersect_hi);
-          poly_add(r+1, c+1, grid);
-          poly_add(r+1, c, hintersect_hi);
-          poly_merge();
-          break;
-        case 71: // 2122
-          poly_start(r, c, hintersect_hi);
-          poly_add(r, c+1, grid);
-          poly_add(r, c+1, vintersect_hi);
-          poly_merge();
-          break;
-        case 53: // 1222
-          poly_start(r, c, vintersect_hi);
-          poly_add(r, c, grid);
-          poly_add(r, c, hintersect_hi);
-          poly_merge();
-          break;
+  virtual void process_cell(int r, int c, int index) {
+    elementary_polygons(r, c, index);
+  }
 
-          // single trapezoid
-        case 78: // 2220
-          poly_start(r, c, vintersect_hi);
-          poly_add(r+1, c, hintersect_hi);
-          poly_add(r+1, c, hintersect_lo);
-          poly_add(r, c, vintersect_lo);
-          poly_merge();
-          break;
-        case 74: // 2202
-          poly_start(r+1, c, hintersect_hi);
-          poly_add(r, c+1, vintersect_hi);
-          poly_add(r, c+1, vintersect_lo);
-          poly_add(r+1, c, hintersect_lo);
-          poly_merge();
-          break;
-        case 62: // 2022
-          poly_start(r, c+1, vintersect_hi);
-          poly_add(r, c, hintersect_hi);
-          poly_add(r, c, hintersect_lo);
-          poly_add(r, c+1, vintersect_lo);
-          poly_merge();
-          break;
-        case 26: // 0222
-          poly_start(r, c, hintersect_hi);
-          poly_add(r, c, vintersect_hi);
-          poly_add(r, c, vintersect_lo);
-          poly_add(r, c, hintersect_lo);
-          poly_merge();
-          break;
-        case 2: // 0002
-          poly_start(r, c, vintersect_lo);
-          poly_add(r+1, c, hintersect_lo);
-          poly_add(r+1, c, hintersect_hi);
-          poly_add(r, c, vintersect_hi);
-          poly_merge();
-          break;
-        case 6: // 0020
-          poly_start(r+1, c, hintersect_lo);
-          poly_add(r, c+1, vintersect_lo);
-          poly_add(r, c+1, vintersect_hi);
-          poly_add(r+1, c, hintersect_hi);
-          poly_merge();
-          break;
-        case 18: // 0200
-          poly_start(r, c+1, vintersect_lo);
-          poly_add(r, c, hintersect_lo);
-          poly_add(r, c, hintersect_hi);
-          poly_add(r, c+1, vintersect_hi);
-          poly_merge();
-          break;
-        case 54: // 2000
-          poly_start(r, c, hintersect_lo);
-          poly_add(r, c, vintersect_lo);
-          poly_add(r, c, vintersect_hi);
-          poly_add(r, c, hintersect_hi);
-          poly_merge();
-          break;
+  // the output vectors are allocated at their final size, after a first pass
+  // over the paths that only counts vertices. When recording parents, the polygon
+  // rings of isobands come with the id of their outer ring, as an integer vector
+  // named parent with one element per ring, see find_parents(). When measuring
+  // paths, each path is measured as its vertices are written, and the
+  // measurements are added to the output as a list named metrics, with the
+  // columns of path_metrics.
+  cpp11::writable::list collect() {
+    R_xlen_t n = count_vertices();
+    cpp11::writable::doubles x_out(n), y_out(n);
+    cpp11::writable::integers id_out(n);
+    vector<int> parent;
+    bool parents = record_parents && traces_rings();
+    metrics.clear();
+    traced_parents = parents ? &parent : nullptr;
+    trace_paths(REAL(x_out), REAL(y_out), INTEGER(id_out));
+    traced_parents = nullptr;
+    cpp11::writable::list out = path_list(x_out, y_out, id_out);
+    if (parents) out.push_back("parent"_nm = parents_of(parent));
+    if (measure_paths) out.push_back("metrics"_nm = metrics.as_list());
+    return out;
+  }
 
-          // single rectangle
-        case 4: // 0011
-          poly_start(r, c, vintersect_lo);
-          poly_add(r, c+1, vintersect_lo);
-          poly_add(r+1, c+1, grid);
-          poly_add(r+1, c, grid);
-          poly_merge();
-          break;
-        case 12: // 0110
-          poly_start(r, c, hintersect_lo);
-          poly_add(r, c+1, grid);
-          poly_add(r+1, c+1, grid);
-          poly_add(r+1, c, hintersect_lo);
-          poly_merge();
-          break;
-        case 36: // 1100
-          poly_start(r, c, grid);
-          poly_add(r, c+1, grid);
-          poly_add(r, c+1, vintersect_lo);
-          poly_add(r, c, vintersect_lo);
-          poly_merge();
-          break;
-        case 28: // 1001
-          poly_start(r, c, hintersect_lo);
-          poly_add(r+1, c, hintersect_lo);
-          poly_add(r+1, c, grid);
-          poly_add(r, c, grid);
-          poly_merge();
-          break;
-        case 76: // 2211
-          poly_start(r, c, vintersect_hi);
-          poly_add(r, c+1, vintersect_hi);
-          poly_add(r+1, c+1, grid);
-          poly_add(r+1, c, grid);
-          poly_merge();
-          break;
-        case 68: // 2112
-          poly_start(r, c, hintersect_hi);
-          poly_add(r, c+1, grid);
-          poly_add(r+1, c+1, grid);
-          poly_add(r+1, c, hintersect_hi);
-          poly_merge();
-          break;
-        case 44: // 1122
-          poly_start(r, c, grid);
-          poly_add(r, c+1, grid);
-          poly_add(r, c+1, vintersect_hi);
-          poly_add(r, c, vintersect_hi);
-          poly_merge();
-          break;
-        case 52: // 1221
-          poly_start(r, c, hintersect_hi);
-          poly_add(r+1, c, hintersect_hi);
-          poly_add(r+1, c, grid);
-          poly_add(r, c, grid);
-          poly_merge();
-          break;
-        case 72: // 2200
-          poly_start(r, c, vintersect_hi);
-          poly_add(r, c+1, vintersect_hi);
-          poly_add(r, c+1, vintersect_lo);
-          poly_add(r, c, vintersect_lo);
-          poly_merge();
-          break;
-        case 56: // 2002
-          poly_start(r, c, hintersect_hi);
-          poly_add(r, c, hintersect_lo);
-          poly_add(r+1, c, hintersect_lo);
-          poly_add(r+1, c, hintersect_hi);
-          poly_merge();
-          break;
-        case 8: // 0022
-          poly_start(r, c, vintersect_lo);
-          poly_add(r, c+1, vintersect_lo);
-          poly_add(r, c+1, vintersect_hi);
-          poly_add(r, c, vintersect_hi);
-          poly_merge();
-          break;
-        case 24: // 0220
-          poly_start(r, c, hintersect_lo);
-          poly_add(r, c, hintersect_hi);
-          poly_add(r+1, c, hintersect_hi);
-          poly_add(r+1, c, hintersect_lo);
-          poly_merge();
-          break;
+  // if rows isn't null, it receives the cell rows that each path touches
+  void collect_paths(contour_paths &paths, path_rows *rows = nullptr) {
+    R_xlen_t n = count_vertices();
+    paths.x.resize(n);
+    paths.y.resize(n);
+    paths.id.resize(n);
+    paths.parent.clear();
+    metrics.clear();
+    if (rows) rows->clear();
+    traced_rows = rows;
+    paths.has_parents = record_parents && traces_rings();
+    traced_parents = paths.has_parents ? &paths.parent : nullptr;
+    trace_paths(paths.x.data(), paths.y.data(), paths.id.data());
+    traced_rows = nullptr;
+    traced_parents = nullptr;
+    paths.measured = measure_paths;
+    swap(paths.metrics, metrics);
+  }
 
-        // single square
-        case 40: // 1111
-          poly_start(r, c, grid);
-          poly_add(r, c+1, grid);
-          poly_add(r+1, c+1, grid);
-          poly_add(r+1, c, grid);
-          poly_merge();
-          break;
+  // supplies the grid values of rows row0, row0 + 1, ... when the grid is streamed,
+  // stored column by column, with columns stride values apart
+  template <class T>
+  void set_grid_rows(const T *z, int row0, int stride) {
+    grid_z_p = z;
+    z_type = value_traits<T>::type;
+    z_row0 = row0;
+    z_stride = stride;
+    keep_coords = true;
+  }
 
-        // single pentagon
-        case 49: // 1211
-          poly_start(r, c, grid);
-          poly_add(r, c, hintersect_hi);
-          poly_add(r, c+1, vintersect_hi);
-          poly_add(r+1, c+1, grid);
-          poly_add(r+1, c, grid);
-          poly_merge();
-          break;
-        case 67: // 2111
-          poly_start(r+1, c, grid);
-          poly_add(r, c, vintersect_hi);
-          poly_add(r, c, hintersect_hi);
-          poly_add(r, c+1, grid);
-          poly_add(r+1, c+1, grid);
-          poly_merge();
-          break;
-        case 41: // 1112
-          poly_start(r, c, grid);
-          poly_add(r, c+1, grid);
-          poly_add(r+1, c+1, grid);
-          poly_add(r+1, c, hintersect_hi);
-          poly_add(r, c, vintersect_hi);
-          poly_merge();
-          break;
-        case 43: // 1121
-          poly_start(r, c, grid);
-          poly_add(r, c+1, grid);
-          poly_add(r, c+1, vintersect_hi);
-          poly_add(r+1, c, hintersect_hi);
-          poly_add(r+1, c, grid);
-          poly_merge();
-          break;
-        case 31: // 1011
-          poly_start(r, c, grid);
-          poly_add(r, c, hintersect_lo);
-          poly_add(r, c+1, vintersect_lo);
-          poly_add(r+1, c+1, grid);
-          poly_add(r+1, c, grid);
-          poly_merge();
-          break;
-        case 13: // 0111
-          poly_start(r+1, c, grid);
-          poly_add(r, c, vintersect_lo);
-          poly_add(r, c, hintersect_lo);
-          poly_add(r, c+1, grid);
-          poly_add(r+1, c+1, grid);
-          poly_merge();
-          break;
-        case 39: // 1110
-          poly_start(r, c, grid);
-          poly_add(r, c+1, grid);
-          poly_add(r+1, c+1, grid);
-          poly_add(r+1, c, hintersect_lo);
-          poly_add(r, c, vintersect_lo);
-          poly_merge();
-          break;
-        case 37: // 1101
-          poly_start(r, c, grid);
-          poly_add(r, c+1, grid);
-          poly_add(r, c+1, vintersect_lo);
-          poly_add(r+1, c, hintersect_lo);
-          poly_add(r+1, c, grid);
-          poly_merge();
-          break;
-        case 45: // 1200
-          poly_start(r, c, grid);
-          poly_add(r, c, hintersect_hi);
-          poly_add(r, c+1, vintersect_hi);
-          poly_add(r, c+1, vintersect_lo);
-          poly_add(r, c, vintersect_lo);
-          poly_merge();
-          break;
-        case 15: // 0120
-          poly_start(r, c+1, grid);
-          poly_add(r, c+1, vintersect_hi);
-          poly_add(r+1, c, hintersect_hi);
-          poly_add(r+1, c, hintersect_lo);
-          poly_add(r, c, hintersect_lo);
-          poly_merge();
-          break;
-        case 5: // 0012
-          poly_start(r, c, vintersect_lo);
-          poly_add(r, c+1, vintersect_lo);
-          poly_add(r+1, c+1, grid);
-          poly_add(r+1, c, hintersect_hi);
-          poly_add(r, c, vintersect_hi);
-          poly_merge();
-          break;
-        case 55: // 2001
-          poly_start(r+1, c, grid);
-          poly_add(r, c, vintersect_hi);
-          poly_add(r, c, hintersect_hi);
-          poly_add(r, c, hintersect_lo);
-          poly_add(r+1, c, hintersect_lo);
-          poly_merge();
-          break;
-        case 35: // 1022
-          poly_start(r, c, grid);
-          poly_add(r, c, hintersect_lo);
-          poly_add(r, c+1, vintersect_lo);
-          poly_add(r, c+1, vintersect_hi);
-          poly_add(r, c, vintersect_hi);
-          poly_merge();
-          break;
-        case 65: // 2102
-          poly_start(r, c+1, grid);
-          poly_add(r, c+1, vintersect_lo);
-          poly_add(r+1, c, hintersect_lo);
-          poly_add(r+1, c, hintersect_hi);
-          poly_add(r, c, hintersect_hi);
-          poly_merge();
-          break;
-        case 75: // 2210
-          poly_start(r, c, vintersect_hi);
-          poly_add(r, c+1, vintersect_hi);
-          poly_add(r+1, c+1, grid);
-          poly_add(r+1, c, hintersect_lo);
-          poly_add(r, c, vintersect_lo);
-          poly_merge();
-          break;
-        case 25: // 0221
-          poly_start(r+1, c, grid);
-          poly_add(r, c, vintersect_lo);
-          poly_add(r, c, hintersect_lo);
-          poly_add(r, c, hintersect_hi);
-          poly_add(r+1, c, hintersect_hi);
-          poly_merge();
-          break;
-        case 29: // 1002
-          poly_start(r, c, grid);
-          poly_add(r, c, hintersect_lo);
-          poly_add(r+1, c, hintersect_lo);
-          poly_add(r+1, c, hintersect_hi);
-          poly_add(r, c, vintersect_hi);
-          poly_merge();
-          break;
-        case 63: // 2100
-          poly_start(r, c+1, grid);
-          poly_add(r, c+1, vintersect_lo);
-          poly_add(r, c, vintersect_lo);
-          poly_add(r, c, vintersect_hi);
-          poly_add(r, c, hintersect_hi);
-          poly_merge();
-          break;
-        case 21: // 0210
-          poly_start(r+1, c+1, grid);
-          poly_add(r+1, c, hintersect_lo);
-          poly_add(r, c, hintersect_lo);
-          poly_add(r, c, hintersect_hi);
-          poly_add(r, c+1, vintersect_hi);
-          poly_merge();
-          break;
-        case 7: // 0021
-          poly_start(r+1, c, grid);
-          poly_add(r, c, vintersect_lo);
-          poly_add(r, c+1, vintersect_lo);
-          poly_add(r, c+1, vintersect_hi);
-          poly_add(r+1, c, hintersect_hi);
-          poly_merge();
-          break;
-        case 51: // 1220
-          poly_start(r, c, grid);
-          poly_add(r, c, hintersect_hi);
-          poly_add(r+1, c, hintersect_hi);
-          poly_add(r+1, c, hintersect_lo);
-          poly_add(r, c, vintersect_lo);
-          poly_merge();
-          break;
-        case 17: // 0122
-          poly_start(r, c+1, grid);
-          poly_add(r, c+1, vintersect_hi);
-          poly_add(r, c, vintersect_hi);
-          poly_add(r, c, vintersect_lo);
-          poly_add(r, c, hintersect_lo);
-          poly_merge();
-          break;
-        case 59: // 2012
-          poly_start(r+1, c+1, grid);
-          poly_add(r+1, c, hintersect_hi);
-          poly_add(r, c, hintersect_hi);
-          poly_add(r, c, hintersect_lo);
-          poly_add(r, c+1, vintersect_lo);
-          poly_merge();
-          break;
-        case 73: // 2201
-          poly_start(r+1, c, grid);
-          poly_add(r, c, vintersect_hi);
-          poly_add(r, c+1, vintersect_hi);
-          poly_add(r, c+1, vintersect_lo);
-          poly_add(r+1, c, hintersect_lo);
-          poly_merge();
-          break;
+  // appends all polygons or lines that are finished to paths, and removes them from
+  // the point store; called when streaming, after contouring the cell rows down to
+  // grid row r. Anything connected to a point on grid row r may still be extended by
+  // the cell rows below; everything else is finished, as is everything once r is
+  // the last grid row.
+  //
+  // Finding the open paths and scanning the store costs as much as the store
+  // holds, so before the last row this is only done once at least half of the
+  // store has been filled since the last time. Finished paths wait in the store
+  // until then, with their coordinates, and the total work stays linear in the
+  // number of points however few rows each block has.
+  void collect_finished(contour_paths &paths, int r) {
+    if (r < nrow - 1 && 2 * (polygon_grid.n_in_use() - open_points) < polygon_grid.size()) {
+      return;
+    }
 
-          // single hexagon
-        case 22: // 0211
-          poly_start(r+1, c, grid);
-          poly_add(r, c, vintersect_lo);
-          poly_add(r, c, hintersect_lo);
-          poly_add(r, c, hintersect_hi);
-          poly_add(r, c+1, vintersect_hi);
-          poly_add(r+1, c+1, grid);
-          poly_merge();
-          break;
-        case 66: // 2110
-          poly_start(r, c+1, grid);
-          poly_add(r+1, c+1, grid);
-          poly_add(r+1, c, hintersect_lo);
-          poly_add(r, c, vintersect_lo);
-          poly_add(r, c, vintersect_hi);
-          poly_add(r, c, hintersect_hi);
-          poly_merge();
-          break;
-        case 38: // 1102
-          poly_start(r, c, grid);
-          poly_add(r, c+1, grid);
-          poly_add(r, c+1, vintersect_lo);
-          poly_add(r+1, c, hintersect_lo);
-          poly_add(r+1, c, hintersect_hi);
-          poly_add(r, c, vintersect_hi);
-          poly_merge();
-          break;
-        case 34: // 1021
-          poly_start(r, c, grid);
-          poly_add(r, c, hintersect_lo);
-          poly_add(r, c+1, vintersect_lo);
-          poly_add(r, c+1, vintersect_hi);
-          poly_add(r+1, c, hintersect_hi);
-          poly_add(r+1, c, grid);
-          poly_merge();
-          break;
-        case 58: // 2011
-          poly_start(r+1, c, grid);
-          poly_add(r, c, vintersect_hi);
-          poly_add(r, c, hintersect_hi);
-          poly_add(r, c, hintersect_lo);
-          poly_add(r, c+1, vintersect_lo);
-          poly_add(r+1, c+1, grid);
-          poly_merge();
-          break;
-        case 14: // 0112
-          poly_start(r, c+1, grid);
-          poly_add(r+1, c+1, grid);
-          poly_add(r+1, c, hintersect_hi);
-          poly_add(r, c, vintersect_hi);
-          poly_add(r, c, vintersect_lo);
-          poly_add(r, c, hintersect_lo);
-          poly_merge();
-          break;
-        case 42: // 1120
-          poly_start(r, c, grid);
-          poly_add(r, c+1, grid);
-          poly_add(r, c+1, vintersect_hi);
-          poly_add(r+1, c, hintersect_hi);
-          poly_add(r+1, c, hintersect_lo);
-          poly_add(r, c, vintersect_lo);
-          poly_merge();
-          break;
-        case 46: // 1201
-          poly_start(r, c, grid);
-          poly_add(r, c, hintersect_hi);
-          poly_add(r, c+1, vintersect_hi);
-          poly_add(r, c+1, vintersect_lo);
-          poly_add(r+1, c, hintersect_lo);
-          poly_add(r+1, c, grid);
-          poly_merge();
-          break;
-        case 64: // 2101
-          poly_start(r+1, c, grid);
-          poly_add(r, c, vintersect_hi);
-          poly_add(r, c, hintersect_hi);
-          poly_add(r, c+1, grid);
-          poly_add(r, c+1, vintersect_lo);
-          poly_add(r+1, c, hintersect_lo);
-          poly_merge();
-          break;
-        case 16: // 0121
-          poly_start(r, c+1, grid);
-          poly_add(r, c+1, vintersect_hi);
-          poly_add(r+1, c, hintersect_hi);
-          poly_add(r+1, c, grid);
-          poly_add(r, c, vintersect_lo);
-          poly_add(r, c, hintersect_lo);
-          poly_merge();
-          break;
-        case 32: // 1012
-          poly_start(r, c, grid);
-          poly_add(r, c, hintersect_lo);
-          poly_add(r, c+1, vintersect_lo);
-          poly_add(r+1, c+1, grid);
-          poly_add(r+1, c, hintersect_hi);
-          poly_add(r, c, vintersect_hi);
-          poly_merge();
-          break;
-        case 48: // 1210
-          poly_start(r, c, grid);
-          poly_add(r, c, hintersect_hi);
-          poly_add(r, c+1, vintersect_hi);
-          poly_add(r+1, c+1, grid);
-          poly_add(r+1, c, hintersect_lo);
-          poly_add(r, c, vintersect_lo);
-          poly_merge();
-          break;
+    vector<char> open(polygon_grid.size(), 0);
+    if (r < nrow - 1) {
+      vector<int> stack = polygon_grid.row_slots(r);
+      while (!stack.empty()) {
+        int i = stack.back();
+        stack.pop_back();
+        if (i < 0 || open[i]) continue;
+        open[i] = 1;
+        const point_connect &pc = polygon_grid[i];
+        stack.push_back(pc.prev);
+        stack.push_back(pc.next);
+        stack.push_back(pc.prev2);
+        stack.push_back(pc.next2);
+      }
+    }
 
-        // 6-sided saddle
-        case 10: // 0101
-          {
-            double vc = central_value(r, c);
-            if (vc < vlo) {
-              poly_start(r+1, c, grid);
-              poly_add(r, c, vintersect_lo);
-              poly_add(r+1, c, hintersect_lo);
-              poly_merge();
-              poly_start(r, c+1, grid);
-              poly_add(r, c+1, vintersect_lo);
-              poly_add(r, c, hintersect_lo);
-              poly_merge();
-            } else {
-              poly_start(r+1, c, grid);
-              poly_add(r, c, vintersect_lo);
-              poly_add(r, c, hintersect_lo);
-              poly_add(r, c+1, grid);
-              poly_add(r, c+1, vintersect_lo);
-              poly_add(r+1, c, hintersect_lo);
-              poly_merge();
-            }
-          }
-          break;
-        case 30: // 1010
-          {
-            double vc = central_value(r, c);
-            if (vc < vlo) {
-              poly_start(r, c, grid);
-              poly_add(r, c, hintersect_lo);
-              poly_add(r, c, vintersect_lo);
-              poly_merge();
-              poly_start(r+1, c+1, grid);
-              poly_add(r+1, c, hintersect_lo);
-              poly_add(r, c+1, vintersect_lo);
-              poly_merge();
-            } else {
-              poly_start(r, c, grid);
-              poly_add(r, c, hintersect_lo);
-              poly_add(r, c+1, vintersect_lo);
-              poly_add(r+1, c+1, grid);
-              poly_add(r+1, c, hintersect_lo);
-              poly_add(r, c, vintersect_lo);
-              poly_merge();
-            }
-          }
-          break;
-        case 70: // 2121
-          {
-            double vc = central_value(r, c);
-            if (vc >= vhi) {
-              poly_start(r+1, c, grid);
-              poly_add(r, c, vintersect_hi);
-              poly_add(r+1, c, hintersect_hi);
-              poly_merge();
-              poly_start(r, c+1, grid);
-              poly_add(r, c+1, vintersect_hi);
-              poly_add(r, c, hintersect_hi);
-              poly_merge();
-            } else {
-              poly_start(r+1, c, grid);
-              poly_add(r, c, vintersect_hi);
-              poly_add(r, c, hintersect_hi);
-              poly_add(r, c+1, grid);
-              poly_add(r, c+1, vintersect_hi);
-              poly_add(r+1, c, hintersect_hi);
-              poly_merge();
-            }
-          }
-          break;
-        case 50: // 1212
-          {
-            double vc = central_value(r, c);
-            if (vc >= vhi) {
-              poly_start(r, c, grid);
-              poly_add(r, c, hintersect_hi);
-              poly_add(r, c, vintersect_hi);
-              poly_merge();
-              poly_start(r+1, c+1, grid);
-              poly_add(r+1, c, hintersect_hi);
-              poly_add(r, c+1, vintersect_hi);
-              poly_merge();
-            } else {
-              poly_start(r, c, grid);
-              poly_add(r, c, hintersect_hi);
-              poly_add(r, c+1, vintersect_hi);
-              poly_add(r+1, c+1, grid);
-              poly_add(r+1, c, hintersect_hi);
-              poly_add(r, c, vintersect_hi);
-              poly_merge();
-            }
-          }
-          break;
+    R_xlen_t n = count_vertices(&open), n_old = paths.id.size();
+    int id_offset = (n_old > 0) ? paths.id.back() : 0;
+    paths.x.resize(n_old + n);
+    paths.y.resize(n_old + n);
+    paths.id.resize(n_old + n);
+    trace_paths(paths.x.data() + n_old, paths.y.data() + n_old, paths.id.data() + n_old, &open);
+    for (R_xlen_t k = n_old; k < n_old + n; k++) {
+      paths.id[k] += id_offset;
+    }
 
-        // 7-sided saddle
-        case 69: // 2120
-          {
-            double vc = central_value(r, c);
-            if (vc >= vhi) {
-              poly_start(r, c+1, grid);
-              poly_add(r, c+1, vintersect_hi);
-              poly_add(r, c, hintersect_hi);
-              poly_merge();
-              poly_start(r, c, vintersect_hi);
-              poly_add(r+1, c, hintersect_hi);
-              poly_add(r+1, c, hintersect_lo);
-              poly_add(r, c, vintersect_lo);
-              poly_merge();
-            } else {
-              poly_start(r, c+1, grid);
-              poly_add(r, c+1, vintersect_hi);
-              poly_add(r+1, c, hintersect_hi);
-              poly_add(r+1, c, hintersect_lo);
-              poly_add(r, c, vintersect_lo);
-              poly_add(r, c, vintersect_hi);
-              poly_add(r, c, hintersect_hi);
-              poly_merge();
-            }
-          }
-          break;
-        case 61: // 2021
-          {
-            double vc = central_value(r, c);
-              if (vc >= vhi) {
-                poly_start(r+1, c, grid);
-                poly_add(r, c, vintersect_hi);
-                poly_add(r+1, c, hintersect_hi);
-                poly_merge();
-                poly_start(r, c+1, vintersect_hi);
-                poly_add(r, c, hintersect_hi);
-                poly_add(r, c, hintersect_lo);
-                poly_add(r, c+1, vintersect_lo);
-                poly_merge();
-              } else {
-                poly_start(r+1, c, grid);
-                poly_add(r, c, vintersect_hi);
-                poly_add(r, c, hintersect_hi);
-                poly_add(r, c, hintersect_lo);
-                poly_add(r, c+1, vintersect_lo);
-                poly_add(r, c+1, vintersect_hi);
-                poly_add(r+1, c, hintersect_hi);
-                poly_merge();
-              }
-            }
-          break;
-        case 47: // 1202
-          {
-            double vc = central_value(r, c);
-            if (vc >= vhi) {
-              poly_start(r, c, grid);
-              poly_add(r, c, hintersect_hi);
-              poly_add(r, c, vintersect_hi);
-              poly_merge();
-              poly_start(r+1, c, hintersect_hi);
-              poly_add(r, c+1, vintersect_hi);
-              poly_add(r, c+1, vintersect_lo);
-              poly_add(r+1, c, hintersect_lo);
-              poly_merge();
-            } else {
-              poly_start(r, c, grid);
-              poly_add(r, c, hintersect_hi);
-              poly_add(r, c+1, vintersect_hi);
-              poly_add(r, c+1, vintersect_lo);
-              poly_add(r+1, c, hintersect_lo);
-              poly_add(r+1, c, hintersect_hi);
-              poly_add(r, c, vintersect_hi);
-              poly_merge();
-            }
-          }
-          break;
-        case 23: // 0212
-          {
-            double vc = central_value(r, c);
-            if (vc >= vhi) {
-              poly_start(r+1, c+1, grid);
-              poly_add(r+1, c, hintersect_hi);
-              poly_add(r, c+1, vintersect_hi);
-              poly_merge();
-              poly_start(r, c, hintersect_hi);
-              poly_add(r, c, vintersect_hi);
-              poly_add(r, c, vintersect_lo);
-              poly_add(r, c, hintersect_lo);
-              poly_merge();
-            } else {
-              poly_start(r+1, c+1, grid);
-              poly_add(r+1, c, hintersect_hi);
-              poly_add(r, c, vintersect_hi);
-              poly_add(r, c, vintersect_lo);
-              poly_add(r, c, hintersect_lo);
-              poly_add(r, c, hintersect_hi);
-              poly_add(r, c+1, vintersect_hi);
-              poly_merge();
-            }
-          }
-          break;
-        case 11: // 0102
-          {
-            double vc = central_value(r, c);
-            if (vc < vlo) {
-              poly_start(r, c+1, grid);
-              poly_add(r, c+1, vintersect_lo);
-              poly_add(r, c, hintersect_lo);
-              poly_merge();
-              poly_start(r, c, vintersect_lo);
-              poly_add(r+1, c, hintersect_lo);
-              poly_add(r+1, c, hintersect_hi);
-              poly_add(r, c, vintersect_hi);
-              poly_merge();
-            } else {
-              poly_start(r, c+1, grid);
-              poly_add(r, c+1, vintersect_lo);
-              poly_add(r+1, c, hintersect_lo);
-              poly_add(r+1, c, hintersect_hi);
-              poly_add(r, c, vintersect_hi);
-              poly_add(r, c, vintersect_lo);
-              poly_add(r, c, hintersect_lo);
-              poly_merge();
-            }
-          }
-          break;
-        case 19: // 0201
-          {
-            double vc = central_value(r, c);
-            if (vc < vlo) {
-              poly_start(r+1, c, grid);
-              poly_add(r, c, vintersect_lo);
-              poly_add(r+1, c, hintersect_lo);
-              poly_merge();
-              poly_start(r, c+1, vintersect_lo);
-              poly_add(r, c, hintersect_lo);
-              poly_add(r, c, hintersect_hi);
-              poly_add(r, c+1, vintersect_hi);
-              poly_merge();
-            } else {
-              poly_start(r+1, c, grid);
-              poly_add(r, c, vintersect_lo);
-              poly_add(r, c, hintersect_lo);
-              poly_add(r, c, hintersect_hi);
-              poly_add(r, c+1, vintersect_hi);
-              poly_add(r, c+1, vintersect_lo);
-              poly_add(r+1, c, hintersect_lo);
-              poly_merge();
-            }
-          }
-          break;
-        case 33: // 1020
-          {
-            double vc = central_value(r, c);
-            if (vc < vlo) {
-              poly_start(r, c, grid);
-              poly_add(r, c, hintersect_lo);
-              poly_add(r, c, vintersect_lo);
-              poly_merge();
-              poly_start(r+1, c, hintersect_lo);
-              poly_add(r, c+1, vintersect_lo);
-              poly_add(r, c+1, vintersect_hi);
-              poly_add(r+1, c, hintersect_hi);
-              poly_merge();
-            } else {
-              poly_start(r, c, grid);
-              poly_add(r, c, hintersect_lo);
-              poly_add(r, c+1, vintersect_lo);
-              poly_add(r, c+1, vintersect_hi);
-              poly_add(r+1, c, hintersect_hi);
-              poly_add(r+1, c, hintersect_lo);
-              poly_add(r, c, vintersect_lo);
-              poly_merge();
-            }
-          }
-          break;
-        case 57: // 2010
-          {
-            double vc = central_value(r, c);
-            if (vc < vlo) {
-              poly_start(r+1, c+1, grid);
-              poly_add(r+1, c, hintersect_lo);
-              poly_add(r, c+1, vintersect_lo);
-              poly_merge();
-              poly_start(r, c, hintersect_lo);
-              poly_add(r, c, vintersect_lo);
-              poly_add(r, c, vintersect_hi);
-              poly_add(r, c, hintersect_hi);
-              poly_merge();
-            } else {
-              poly_start(r+1, c+1, grid);
-              poly_add(r+1, c, hintersect_lo);
-              poly_add(r, c, vintersect_lo);
-              poly_add(r, c, vintersect_hi);
-              poly_add(r, c, hintersect_hi);
-              poly_add(r, c, hintersect_lo);
-              poly_add(r, c+1, vintersect_lo);
-              poly_merge();
-            }
-          }
-          break;
+    for (int i = 0; i < polygon_grid.size(); i++) {
+      if (polygon_grid.in_use(i) && !open[i]) polygon_grid.release(i);
+    }
+    open_points = polygon_grid.n_in_use();
+  }
 
-        // 8-sided saddle
-      case 60: // 2020
-        {
-          double vc = central_value(r, c);
-          if (vc < vlo) {
-            poly_start(r, c, vintersect_hi);
-            poly_add(r, c, hintersect_hi);
-            poly_add(r, c, hintersect_lo);
-            poly_add(r, c, vintersect_lo);
-            poly_merge();
-            poly_start(r, c+1, vintersect_hi);
-            poly_add(r+1, c, hintersect_hi);
-            poly_add(r+1, c, hintersect_lo);
-            poly_add(r, c+1, vintersect_lo);
-            poly_merge();
-          } else if (vc >= vhi) {
-            poly_start(r, c, vintersect_hi);
-            poly_add(r+1, c, hintersect_hi);
-            poly_add(r+1, c, hintersect_lo);
-            poly_add(r, c, vintersect_lo);
-            poly_merge();
-            poly_start(r, c+1, vintersect_hi);
-            poly_add(r, c, hintersect_hi);
-            poly_add(r, c, hintersect_lo);
-            poly_add(r, c+1, vintersect_lo);
-            poly_merge();
-          } else {
-            poly_start(r, c, vintersect_hi);
-            poly_add(r, c, hintersect_hi);
-            poly_add(r, c, hintersect_lo);
-            poly_add(r, c+1, vintersect_lo);
-            poly_add(r, c+1, vintersect_hi);
-            poly_add(r+1, c, hintersect_hi);
-            poly_add(r+1, c, hintersect_lo);
-            poly_add(r, c, vintersect_lo);
-            poly_merge();
-          }
-        }
-        break;
-        case 20: // 0202
-          {
-            double vc = central_value(r, c);
-            if (vc < vlo) {
-              poly_start(r, c, vintersect_lo);
-              poly_add(r+1, c, hintersect_lo);
-              poly_add(r+1, c, hintersect_hi);
-              poly_add(r, c, vintersect_hi);
-              poly_merge();
-              poly_start(r, c+1, vintersect_lo);
-              poly_add(r, c, hintersect_lo);
-              poly_add(r, c, hintersect_hi);
-              poly_add(r, c+1, vintersect_hi);
-              poly_merge();
-            } else if (vc >= vhi) {
-              poly_start(r, c, vintersect_lo);
-              poly_add(r, c, hintersect_lo);
-              poly_add(r, c, hintersect_hi);
-              poly_add(r, c, vintersect_hi);
-              poly_merge();
-              poly_start(r, c+1, vintersect_lo);
-              poly_add(r+1, c, hintersect_lo);
-              poly_add(r+1, c, hintersect_hi);
-              poly_add(r, c+1, vintersect_hi);
-              poly_merge();
-            } else {
-              poly_start(r, c, vintersect_lo);
-              poly_add(r, c, hintersect_lo);
-              poly_add(r, c, hintersect_hi);
-              poly_add(r, c+1, vintersect_hi);
-              poly_add(r, c+1, vintersect_lo);
-              poly_add(r+1, c, hintersect_lo);
-              poly_add(r+1, c, hintersect_hi);
-              poly_add(r, c, vintersect_hi);
-              poly_merge();
-            }
-          }
-          break;
-        }
+  // counts the vertices of the paths to be collected; with a filter, the paths
+  // are measured and selected first, so that those left out are skipped by
+  // the next call of trace_paths()
+  R_xlen_t count_vertices(const vector<char> *skip = nullptr) {
+    path_kept.clear();
+    R_xlen_t n = 0;
+    if (filter.active()) {
+      vector<path_shape> shapes;
+      trace_paths(nullptr, nullptr, nullptr, skip, &shapes);
+      select_paths(shapes);
+      for (unsigned int k = 0; k < shapes.size(); k++) {
+        if (path_kept[k]) n += shapes[k].n;
       }
+    } else {
+      n = trace_paths(nullptr, nullptr, nullptr, skip);
+    }
+    polygon_grid.reset_collected();
+    return n;
+  }
+
+  // decides which of the measured paths are kept. A path inside one that is left
+  // out is left out as well, so that no hole is kept without the polygon around
+  // it, and no polygon is kept inside a hole that is filled. Paths inside a path
+  // with too small an area have a smaller area still, so we only need to look
+  // for paths inside those with too few vertices, whose points we have.
+  void select_paths(vector<path_shape> &shapes) {
+    int n = shapes.size();
+    path_kept.assign(n, 1);
+    vector<int> dropped, kept;
+    for (int k = 0; k < n; k++) {
+      const path_shape &s = shapes[k];
+      if (s.n < filter.min_vertices || (s.closed && fabs(s.area2) / 2 < filter.min_area)) {
+        path_kept[k] = 0;
+        if (s.closed && s.n < filter.min_vertices) dropped.push_back(k);
+      } else {
+        kept.push_back(k);
+      }
+    }
+    if (dropped.empty() || kept.empty()) return;
+
+    // the paths inside a dropped one are among those whose bounding box
+    // starts within its x range
+    sort(kept.begin(), kept.end(), [&](int i, int j) {return shapes[i].xmin < shapes[j].xmin;});
+    for (auto d = dropped.begin(); d != dropped.end(); d++) {
+      path_shape &s = shapes[*d];
+      if (!(s.points.back() == s.first)) s.points.push_back(s.first); // point_in_polygon() wants closed rings
+      auto it = lower_bound(kept.begin(), kept.end(), s.xmin, [&](int i, double x) {return shapes[i].xmin < x;});
+      for (; it != kept.end() && shapes[*it].xmin <= s.xmax; it++) {
+        const path_shape &t = shapes[*it];
+        if (!path_kept[*it] || t.xmax > s.xmax || t.ymin < s.ymin || t.ymax > s.ymax) continue;
+        // the two rings may touch, but not in two consecutive vertices
+        in_polygon_type where = point_in_polygon(t.first, s.points);
+        if (where == undetermined && t.n > 1) where = point_in_polygon(t.second, s.points);
+        if (where == inside) path_kept[*it] = 0;
+      }
+    }
+  }
+
+  // whether the paths are polygon rings, which have an outer ring
+  virtual bool traces_rings() const {return true;}
+
+  // Every ring bounds a region of the band, as joined while merging the
+  // elementary polygons, and all rings bounding the same region belong to one
+  // polygon. The region lies inside its outer ring and outside of the others,
+  // its holes, so the outer ring is the one enclosing the largest area. Writes
+  // the id of the outer ring of each ring, given the region and twice the
+  // signed area of every ring, to parent. Rings left out of the output can't
+  // be outer rings of any that are kept, see select_paths().
+  void find_parents(const vector<int> &ring_region, const vector<double> &ring_area2, vector<int> &parent) {
+    vector<int> outer(polygon_grid.n_regions(), -1);
+    int n = ring_region.size();
+    for (int k = 0; k < n; k++) {
+      int &o = outer[ring_region[k]];
+      if (o < 0 || fabs(ring_area2[k]) > fabs(ring_area2[o])) o = k;
+    }
+    parent.resize(n);
+    for (int k = 0; k < n; k++) {
+      parent[k] = outer[ring_region[k]] + 1;
     }
   }
 
-  virtual cpp11::writable::list collect() {// make polygons
-    cpp11::writable::doubles x_out, y_out;
-    cpp11::writable::integers id;  // vectors holding resulting polygon paths
+  // walks along all polygons, writing their vertex coordinates and polygon ids
+  // to x_out, y_out, and id, unless these are null; returns the number of vertices.
+  // Store entries marked in skip, which must be closed under connections, are left out,
+  // as are the paths not kept by select_paths(). If shapes isn't null, each path is
+  // measured into it, see count_vertices(). When measuring paths, the written paths
+  // are measured into metrics. With traced_parents, the outer ring of each written
+  // ring is found as well.
+  virtual R_xlen_t trace_paths(double *x_out, double *y_out, int *id, const vector<char> *skip = nullptr,
+                               vector<path_shape> *shapes = nullptr) {// make polygons
+    R_xlen_t n = 0;
     int cur_id = 0;           // id counter for the polygon lines
+    int path = 0;             // counter for all paths found, including those left out
+    bool parents = traced_parents && x_out;
+    vector<int> ring_region;  // with parents, the region and twice the area of each written ring
+    vector<double> ring_area2;
 
     // iterate over all locations in the polygon grid
-    for (auto it = polygon_grid.begin(); it != polygon_grid.end(); it++) {
-      if (((it->second).collected && !(it->second).altpoint) ||
-          ((it->second).collected && (it->second).collected2 && (it->second).altpoint)) {
+    for (int it = 0; it < polygon_grid.size(); it++) {
+      if (!polygon_grid.in_use(it) || (skip && (*skip)[it])) {
+        continue; // skip unused entries in the point store
+      }
+      const point_connect &pc = polygon_grid[it];
+      if ((pc.collected && !pc.altpoint) ||
+          (pc.collected && pc.collected2 && pc.altpoint)) {
         continue; // skip any grid points that are already fully collected
       }
 
       // we have found a new polygon line; process it
-      cur_id++;
-
-      grid_point start = it->first;
-      grid_point cur = start;
-      grid_point prev = (it->second).prev;
+      bool keep = path_kept.empty() || path_kept[path];
+      path++;
+      if (keep) cur_id++;
+      if (shapes) shapes->push_back(path_shape());
+      bool measure = keep && x_out && measure_paths;
+      path_measure m;
+      int r_first = nrow, r_last = -1;
+      int region = -1;
+      double area2 = 0;
+      point first, last;
+
+      int cur = it;
+      int prev = pc.prev;
       // if this point has an alternative and it hasn't been collected yet then we start there
-      if ((it->second).altpoint && !(it->second).collected2) prev = (it->second).prev2;
+      if (pc.altpoint && !pc.collected2) prev = pc.prev2;
 
       int i = 0;
+      bool done = false;
       do {
-        point p = calc_point_coords(cur);
-        x_out.push_back(p.x);
-        y_out.push_back(p.y);
-        id.push_back(cur_id);
+        if (keep) {
+          if (x_out) {
+            point p = coords_of(cur);
+            x_out[n] = p.x;
+            y_out[n] = p.y;
+            id[n] = cur_id;
+            if (measure) m.add(p);
+            if (parents) {
+              // relative to the first point, for accuracy
+              if (i == 0) first = last = p;
+              area2 += (last.x - first.x) * (p.y - first.y) - (p.x - first.x) * (last.y - first.y);
+              last = p;
+            }
+          }
+          n++;
+        }
+        if (shapes) shapes->back().add(coords_of(cur), filter.min_vertices);
+        if (traced_rows) add_cell_rows(cur, r_first, r_last);
 
         // record that we have processed this point and proceed to next
-        if (polygon_grid[cur].altpoint && polygon_grid[cur].prev2 == prev) {
+        point_connect &cur_pc = polygon_grid[cur];
+        if (cur_pc.altpoint && cur_pc.prev2 == prev) {
           // if an alternative point exists and its previous point in the polygon
           // corresponds to the recorded previous point, then that's the point
           // we're working with here
 
           // mark current point as collected and advance
-          polygon_grid[cur].collected2 = true;
-          grid_point newcur = polygon_grid[cur].next2;
+          cur_pc.collected2 = true;
+          region = cur_pc.region2;
           prev = cur;
-          cur = newcur;
+          cur = cur_pc.next2;
         } else {
           // mark current point as collected and advance
-          polygon_grid[cur].collected = true;
-          grid_point newcur = polygon_grid[cur].next;
+          cur_pc.collected = true;
+          region = cur_pc.region;
           prev = cur;
-          cur = newcur;
+          cur = cur_pc.next;
         }
         i++;
         if (i % 100000 == 0) {
-          cpp11::check_user_interrupt();
+          check_interrupt();
         }
-      } while (!(cur == start)); // keep going until we reach the start point again
-    }
 
-    return cpp11::writable::list({
-      "x"_nm = x_out,
-      "y"_nm = y_out,
-      "id"_nm = id
-    });
+        // keep going until we reach the start point again through the same
+        // connection; a polygon can pass through an alternative point twice
+        const point_connect &next_pc = polygon_grid[cur];
+        done = (next_pc.altpoint && next_pc.prev2 == prev) ? next_pc.collected2 : next_pc.collected;
+      } while (!done);
+      if (measure) metrics.add(cur_id, m, true, true);
+      if (traced_rows) traced_rows->add(keep, r_first, r_last);
+      if (parents && keep) {
+        ring_region.push_back(polygon_grid.find_region(region));
+        ring_area2.push_back(area2);
+      }
+    }
+    if (parents) find_parents(ring_region, ring_area2, *traced_parents);
+    return n;
   }
 };
 
@@ -1311,35 +1693,39 @@ protected:
   void line_merge() { // merge current elementary polygon to prior polygons
     //cout << "merging points: " << tmp_poly[0] << " " << tmp_poly[1] << endl;
 
-    int score = 2*polygon_grid.count(tmp_poly[1]) + polygon_grid.count(tmp_poly[0]);
+    bool existed0, existed1;
+    int p0 = lookup_point(tmp_poly[0], existed0);
+    int p1 = lookup_point(tmp_poly[1], existed1);
+
+    int score = 2*existed1 + existed0;
 
     switch(score) {
     case 0: // completely unconnected line segment
-      polygon_grid[tmp_poly[0]].next = tmp_poly[1];
-      polygon_grid[tmp_poly[1]].prev = tmp_poly[0];
+      polygon_grid[p0].next = p1;
+      polygon_grid[p1].prev = p0;
       break;
     case 1: // only first point connects
-      if (polygon_grid[tmp_poly[0]].next == grid_point()) {
-        polygon_grid[tmp_poly[0]].next = tmp_poly[1];
-        polygon_grid[tmp_poly[1]].prev = tmp_poly[0];
-      } else if (polygon_grid[tmp_poly[0]].prev == grid_point()) {
-        polygon_grid[tmp_poly[0]].prev = tmp_poly[1];
-        polygon_grid[tmp_poly[1]].next = tmp_poly[0];
+      if (polygon_grid[p0].next == -1) {
+        polygon_grid[p0].next = p1;
+        polygon_grid[p1].prev = p0;
+      } else if (polygon_grid[p0].prev == -1) {
+        polygon_grid[p0].prev = p1;
+        polygon_grid[p1].next = p0;
       } else {
         // should never go here
-        cpp11::stop("cannot merge line segment at interior of existing line segment");
+        stop("cannot merge line segment at interior of existing line segment");
       }
       break;
     case 2: // only second point connects
-      if (polygon_grid[tmp_poly[1]].next == grid_point()) {
-        polygon_grid[tmp_poly[1]].next = tmp_poly[0];
-        polygon_grid[tmp_poly[0]].prev = tmp_poly[1];
-      } else if (polygon_grid[tmp_poly[1]].prev == grid_point()) {
-        polygon_grid[tmp_poly[1]].prev = tmp_poly[0];
-        polygon_grid[tmp_poly[0]].next = tmp_poly[1];
+      if (polygon_grid[p1].next == -1) {
+        polygon_grid[p1].next = p0;
+        polygon_grid[p0].prev = p1;
+      } else if (polygon_grid[p1].prev == -1) {
+        polygon_grid[p1].prev = p0;
+        polygon_grid[p0].next = p1;
       } else {
         // should never go here
-        cpp11::stop("cannot merge line segment at interior of existing line segment");
+        stop("cannot merge line segment at interior of existing line segment");
       }
       break;
     case 3: // two-way merge
@@ -1347,309 +1733,1534 @@ protected:
       //break; // two-way merge doesn't work yet
       {
         int score2 =
-          8*(polygon_grid[tmp_poly[0]].next == grid_point()) +
-          4*(polygon_grid[tmp_poly[0]].prev == grid_point()) +
-          2*(polygon_grid[tmp_poly[1]].next == grid_point()) +
-          (polygon_grid[tmp_poly[1]].prev == grid_point());
+          8*(polygon_grid[p0].next == -1) +
+          4*(polygon_grid[p0].prev == -1) +
+          2*(polygon_grid[p1].next == -1) +
+          (polygon_grid[p1].prev == -1);
 
         switch(score2) {
         case 9: // 1001
-          polygon_grid[tmp_poly[0]].next = tmp_poly[1];
-          polygon_grid[tmp_poly[1]].prev = tmp_poly[0];
+          polygon_grid[p0].next = p1;
+          polygon_grid[p1].prev = p0;
           break;
         case 6: // 0110
-          polygon_grid[tmp_poly[0]].prev = tmp_poly[1];
-          polygon_grid[tmp_poly[1]].next = tmp_poly[0];
+          polygon_grid[p0].prev = p1;
+          polygon_grid[p1].next = p0;
           break;
         case 10: // 1010
           {
-            polygon_grid[tmp_poly[0]].next = tmp_poly[1];
-            polygon_grid[tmp_poly[1]].next = tmp_poly[0];
+            polygon_grid[p0].next = p1;
+            polygon_grid[p1].next = p0;
 
             // need to reverse connections
-            grid_point cur = tmp_poly[1];
+            int cur = p1;
             int i = 0;
             do {
-              grid_point tmp = polygon_grid[cur].prev;
+              int tmp = polygon_grid[cur].prev;
               polygon_grid[cur].prev = polygon_grid[cur].next;
               polygon_grid[cur].next = tmp;
               cur = tmp;
               i++;
               if (i % 100000 == 0) {
-                cpp11::check_user_interrupt();
+                check_interrupt();
               }
-            } while (!(cur == grid_point()));
+            } while (cur != -1);
           }
           break;
         case 5: // 0101
           {
-            polygon_grid[tmp_poly[0]].prev = tmp_poly[1];
-            polygon_grid[tmp_poly[1]].prev = tmp_poly[0];
+            polygon_grid[p0].prev = p1;
+            polygon_grid[p1].prev = p0;
 
             // need to reverse connections
-            grid_point cur = tmp_poly[0];
+            int cur = p0;
             int i = 0;
             do {
-              grid_point tmp = polygon_grid[cur].next;
+              int tmp = polygon_grid[cur].next;
               polygon_grid[cur].next = polygon_grid[cur].prev;
               polygon_grid[cur].prev = tmp;
               cur = tmp;
               i++;
               if (i % 100000 == 0) {
-                cpp11::check_user_interrupt();
+                check_interrupt();
               }
-            } while (!(cur == grid_point()));
+            } while (cur != -1);
           }
           break;
         default:  // should never go here
-          cpp11::stop("cannot merge line segment at interior of existing line segment");
+          stop("cannot merge line segment at interior of existing line segment");
         }
       }
     break;
     default:
-      cpp11::stop("unknown merge state");
+      stop("unknown merge state");
     }
 
     //cout << "new grid:" << endl;
     //print_polygons_state();
   }
 
+  // two-segment saddles (5 and 10) are drawn the other way
+  // round when their central value is below the isoline
+  int saddle_index(int r, int c, int index) {
+    if ((index == 5 || index == 10) && (central_value(r, c) < vlo)) {
+      return 15 - index;
+    }
+    return index;
+  }
+
+  // merges the line segments of cell (r, c) with binary index `index`
+  // into the polygon grid, see line_segments
+  void elementary_lines(int r, int c, int index) {
+    const cell_lines &lines = line_segments[index];
+    for (int k = 0; k < lines.size; k++) {
+      const vertex_offset &p = cell_vertex_points[lines.from[k]], &q = cell_vertex_points[lines.to[k]];
+      line_start(r + p.dr, c + p.dc, p.type);
+      line_add(r + q.dr, c + q.dc, q.type);
+      line_merge();
+    }
+  }
+
 public:
-  isoliner(cpp11::doubles x, cpp11::doubles y, cpp11::doubles_matrix<> z, double value = 0) :
+  isoliner(cpp11::doubles x, cpp11::doubles y, cpp11::sexp z, double value = 0) :
     isobander(x, y, z, value, 0) {}
 
+  isoliner(cpp11::doubles x, cpp11::doubles y, int nrow_in, int ncol_in, double value = 0) :
+    isobander(x, y, nrow_in, ncol_in, value, 0) {}
+
   void set_value(double value) {
     vlo = value;
   }
 
-  virtual void calculate_contour() {
-    // clear polygon grid and associated internal variables
-    reset_grid();
-
-    // setup matrix of binarized cell representations
-    vector<int> binarized(nrow*ncol);
-    vector<int>::iterator iv = binarized.begin();
-    for (int i = 0; i < nrow * ncol; ++i) {
-      *iv = (grid_z_p[i] >= vlo);
-      iv++;
-    }
-
-    vector<int> cells((nrow - 1) * (ncol - 1));
-
-    for (int r = 0; r < nrow-1; r++) {
-      for (int c = 0; c < ncol-1; c++) {
-        int index;
-        if (!R_finite(grid_z_p[r + c * nrow]) || !R_finite(grid_z_p[r + (c + 1) * nrow]) ||
-            !R_finite(grid_z_p[r + 1 + c * nrow]) || !R_finite(grid_z_p[r + 1 + (c + 1) * nrow])) {
-          // we don't draw any contours if at least one of the corners is NA
-          index = 0;
-        } else {
-          index = 8*binarized[r + c * nrow] + 4*binarized[r + (c + 1) * nrow] + 2*binarized[r + 1 + (c + 1) * nrow] + 1*binarized[r + 1 + c * nrow];
-        }
+  virtual void calculate_rows(int r_first, int r_last) {
+    // with an infinite upper limit, the grid points are classified as below
+    // (0) or at or above (1) the isoline value
+    process_cells(r_first, r_last, R_PosInf, 2, vlo, [this](int r, int c, int index) {
+      if (index == 0 || index == 15) return; // no contour, or an NA corner
+      elementary_lines(r, c, saddle_index(r, c, index));
+    });
+  }
 
-        // two-segment saddles
-        if (index == 5 && (central_value(r, c) < vlo)) {
-          index = 10;
-        } else if (index == 10 && (central_value(r, c) < vlo)) {
-          index = 5;
-        }
+  virtual void row_codes(int r_first, int r_last, unsigned char *codes) {
+    int n = r_last - r_first;
+    process_cells(r_first, r_last, R_PosInf, 2, vlo, [&](int r, int c, int index) {
+      codes[(ptrdiff_t)c * n + r - r_first] = saddle_index(r, c, index);
+    });
+  }
 
-        cells[r + c * (nrow - 1)] = index;
+  // calculates the length of the isoline and the number of cells it passes
+  // through, from the line segments of each cell; see isobander::calculate_stats()
+  virtual contour_stats calculate_stats() {
+    reset_grid();
+    contour_stats stats;
+    process_cells(0, nrow - 1, R_PosInf, 2, vlo, [&](int r, int c, int index) {
+      if (index == 0 || index == 15) return;
+      stats.cells++;
+      const cell_lines &lines = line_segments[saddle_index(r, c, index)];
+      for (int k = 0; k < lines.size; k++) {
+        point p = vertex_coords(r, c, lines.from[k]), q = vertex_coords(r, c, lines.to[k]);
+        stats.length += hypot(q.x - p.x, q.y - p.y);
       }
-    }
+    });
+    return stats;
+  }
 
-    cpp11::check_user_interrupt();
+  bool may_have_contour(int r, int c) const {
+    return !ranges || ranges->overlaps(r, c, vlo, vlo);
+  }
 
-    for (int r = 0; r < nrow-1; r++) {
-      for (int c = 0; c < ncol-1; c++) {
-        switch(cells[r + c * (nrow - 1)]) {
-        case 0: break;
-        case 1:
-          line_start(r, c, vintersect_lo);
-          line_add(r+1, c, hintersect_lo);
-          line_merge();
-          break;
-        case 2:
-          line_start(r, c+1, vintersect_lo);
-          line_add(r+1, c, hintersect_lo);
-          line_merge();
-          break;
-        case 3:
-          line_start(r, c, vintersect_lo);
-          line_add(r, c+1, vintersect_lo);
-          line_merge();
-          break;
-        case 4:
-          line_start(r, c, hintersect_lo);
-          line_add(r, c+1, vintersect_lo);
-          line_merge();
-          break;
-        case 5:
-          // like case 2
-          line_start(r, c+1, vintersect_lo);
-          line_add(r+1, c, hintersect_lo);
-          line_merge();
-          // like case 7
-          line_start(r, c, hintersect_lo);
-          line_add(r, c, vintersect_lo);
-          line_merge();
-          break;
-        case 6:
-          line_start(r, c, hintersect_lo);
-          line_add(r+1, c, hintersect_lo);
-          line_merge();
-          break;
-        case 7:
-          line_start(r, c, hintersect_lo);
-          line_add(r, c, vintersect_lo);
-          line_merge();
-          break;
-        case 8:
-          line_start(r, c, hintersect_lo);
-          line_add(r, c, vintersect_lo);
-          line_merge();
-          break;
-        case 9:
-          line_start(r, c, hintersect_lo);
-          line_add(r+1, c, hintersect_lo);
-          line_merge();
-          break;
-        case 10:
-          // like case 1
-          line_start(r, c, vintersect_lo);
-          line_add(r+1, c, hintersect_lo);
-          line_merge();
-          // like case 4
-          line_start(r, c, hintersect_lo);
-          line_add(r, c+1, vintersect_lo);
-          line_merge();
-          break;
-        case 11:
-          line_start(r, c, hintersect_lo);
-          line_add(r, c+1, vintersect_lo);
-          line_merge();
-          break;
-        case 12:
-          line_start(r, c, vintersect_lo);
-          line_add(r, c+1, vintersect_lo);
-          line_merge();
-          break;
-        case 13:
-          line_start(r, c+1, vintersect_lo);
-          line_add(r+1, c, hintersect_lo);
-          line_merge();
-          break;
-        case 14:
-          line_start(r, c, vintersect_lo);
-          line_add(r+1, c, hintersect_lo);
-          line_merge();
-          break;
-        default: break; // catch everything, just in case
-        }
-      }
+  virtual int cell_index(int r, int c) {
+    double z[4] = {z_at(r, c), z_at(r, c + 1), z_at(r + 1, c + 1), z_at(r + 1, c)};
+    int index = 0;
+    for (int k = 0; k < 4; k++) {
+      if (!R_finite(z[k])) return 0;
+      index = 2*index + (z[k] >= vlo);
     }
+    return saddle_index(r, c, index);
+  }
+
+  virtual void process_cell(int r, int c, int index) {
+    elementary_lines(r, c, index);
   }
 
-  virtual cpp11::writable::list collect() {
+  virtual bool traces_rings() const {return false;}
+
+  virtual R_xlen_t trace_paths(double *x_out, double *y_out, int *id, const vector<char> *skip = nullptr,
+                               vector<path_shape> *shapes = nullptr) {
     // make line segments
-    cpp11::writable::doubles x_out, y_out;
-    cpp11::writable::integers id;  // vectors holding resulting polygon paths
+    R_xlen_t n = 0;
     int cur_id = 0;           // id counter for individual line segments
+    int path = 0;             // counter for all lines found, including those left out
 
     // iterate over all locations in the polygon grid
-    for (auto it = polygon_grid.begin(); it != polygon_grid.end(); it++) {
-      //cout << it->first << " " << (it->second).collected << endl;
-      if ((it->second).collected) {
-        continue; // skip any grid points that are already collected
+    for (int it = 0; it < polygon_grid.size(); it++) {
+      //cout << polygon_grid.point_at(it) << " " << polygon_grid[it].collected << endl;
+      if (!polygon_grid.in_use(it) || polygon_grid[it].collected || (skip && (*skip)[it])) {
+        continue; // skip any grid points that are unused, already collected, or left out
       }
 
       // we have found a new polygon line; process it
-      cur_id++;
-
-      grid_point start = it->first;
-      grid_point cur = start;
+      bool keep = path_kept.empty() || path_kept[path];
+      path++;
+      if (keep) cur_id++;
+      if (shapes) shapes->push_back(path_shape());
+      bool measure = keep && x_out && measure_paths;
+      path_measure m;
+      R_xlen_t n_start = n;
+      int r_first = nrow, r_last = -1;
+
+      int start = it;
+      int cur = start;
 
       int i = 0;
-      if (!(polygon_grid[cur].prev == grid_point())) {
+      if (polygon_grid[cur].prev != -1) {
         // back-track until we find the beginning of the line or circle around once
         do {
           cur = polygon_grid[cur].prev;
           i++;
           if (i % 100000 == 0) {
-            cpp11::check_user_interrupt();
+            check_interrupt();
           }
-        } while (!(cur == start || polygon_grid[cur].prev == grid_point()));
+        } while (!(cur == start || polygon_grid[cur].prev == -1));
       }
 
       start = cur; // reset starting point
       i = 0;
       do {
-        //cout << cur << endl;
-        point p = calc_point_coords(cur);
-
-        x_out.push_back(p.x);
-        y_out.push_back(p.y);
-        id.push_back(cur_id);
+        //cout << polygon_grid.point_at(cur) << endl;
+        if (keep) {
+          if (x_out) {
+            point p = coords_of(cur);
+            x_out[n] = p.x;
+            y_out[n] = p.y;
+            id[n] = cur_id;
+            if (measure) m.add(p);
+          }
+          n++;
+        }
+        if (shapes) shapes->back().add(coords_of(cur), filter.min_vertices);
+        if (traced_rows) add_cell_rows(cur, r_first, r_last);
 
         // record that we have processed this point and proceed to next
         polygon_grid[cur].collected = true;
         cur = polygon_grid[cur].next;
         i++;
         if (i % 100000 == 0) {
-          cpp11::check_user_interrupt();
+          check_interrupt();
         }
-      } while (!(cur == start || cur == grid_point())); // keep going until we reach the start point again
+      } while (!(cur == start || cur == -1)); // keep going until we reach the start point again
       // if we're back to start, need to output that point one more time
       if (cur == start) {
-        point p = calc_point_coords(cur);
-        x_out.push_back(p.x);
-        y_out.push_back(p.y);
-        id.push_back(cur_id);
+        if (keep) {
+          if (x_out) {
+            point p = coords_of(cur);
+            x_out[n] = p.x;
+            y_out[n] = p.y;
+            id[n] = cur_id;
+            if (measure) m.add(p);
+          }
+          n++;
+        }
+        if (shapes) shapes->back().add(coords_of(cur), filter.min_vertices);
+      }
+      if (shapes) shapes->back().closed = (cur == start);
+      // as in path_metrics_impl(), lines that end where they start have an area
+      if (measure) metrics.add(cur_id, m, false, n - n_start > 1 && m.last == m.first);
+      if (traced_rows) traced_rows->add(keep, r_first, r_last);
+    }
+    return n;
+  }
+};
+
+// The contour of a grid can be calculated in horizontal strips of cell rows,
+// each into its own point store. The stores are then concatenated, and the
+// first cell row of every strip but the first, whose elementary polygons
+// connect to points in both neighboring strips, is processed last. This
+// stitches together the polygons or lines that cross the seams between strips.
+
+// the point store of a strip, along with the slot indices of its top and bottom
+// grid rows, which are needed to find the points the seam cells connect to
+struct strip_topology {
+  grid_store store;
+  vector<int> top, bottom;
+
+  strip_topology(int ncol = 0) : store(ncol) {}
+};
+
+// n_strips strips of about equal height; strip s covers the cell
+// rows bounds[s], ..., bounds[s+1]-1
+vector<int> strip_bounds(int n_cell_rows, int n_strips) {
+  vector<int> bounds(n_strips + 1);
+  for (int s = 0; s <= n_strips; s++) {
+    bounds[s] = (long long)n_cell_rows * s / n_strips;
+  }
+  return bounds;
+}
+
+// calculates strip s with iso, and swaps the result into strip
+template <class T>
+void calculate_strip(T &iso, const vector<int> &bounds, int s, strip_topology &strip) {
+  int r_first = bounds[s], r_last = bounds[s+1];
+  iso.reset_grid();
+  if (s > 0) {
+    // skip the seam row and do one row by itself, so its
+    // top grid row is still in the slot index afterwards
+    iso.calculate_rows(r_first + 1, r_first + 2);
+    strip.top = iso.polygon_grid.row_slots(r_first + 1);
+    r_first += 2;
+  }
+  iso.calculate_rows(r_first, r_last);
+  strip.bottom = iso.polygon_grid.row_slots(r_last);
+  swap(strip.store, iso.polygon_grid);
+}
+
+// concatenates the strips into the point store of iso and processes the seams.
+// The strips are left empty, unless keep is true. Unless only is null, just the
+// strips marked in it are joined, along with their seam rows; nothing of those
+// left out may connect to them.
+template <class T>
+void join_strips(T &iso, const vector<int> &bounds, vector<strip_topology> &strips, bool keep,
+                 const vector<char> *only) {
+  if (only) {
+    iso.polygon_grid.clear();
+  } else if (keep) {
+    iso.polygon_grid = strips[0].store;
+  } else {
+    iso.polygon_grid = move(strips[0].store);
+  }
+  int prev_offset = 0;
+  for (unsigned int s = only ? 0 : 1; s < strips.size(); s++) {
+    if (only && !(*only)[s]) continue;
+    int offset = iso.polygon_grid.append(strips[s].store);
+    if (!keep) strips[s].store.clear();
+    if (s == 0) continue;
+
+    int r = bounds[s];
+    iso.polygon_grid.start_block(r, r + 1);
+    if (!only || (*only)[s-1]) iso.polygon_grid.set_row_slots(r, strips[s-1].bottom, prev_offset);
+    iso.polygon_grid.set_row_slots(r + 1, strips[s].top, offset);
+    for (int c = 0; c < iso.ncol - 1; c++) {
+      if (iso.may_have_contour(r, c)) iso.process_cell(r, c, iso.cell_index(r, c));
+    }
+    prev_offset = offset;
+  }
+}
+
+// sets the level of an isobander to lo to hi, or that of an isoliner to lo
+void set_level(isobander &ib, double lo, double hi) {ib.set_value(lo, hi);}
+void set_level(isoliner &il, double lo, double) {il.set_value(lo);}
+
+// calculates the contour of an isobander or isoliner on up to `threads` threads,
+// by contouring strips of the grid concurrently
+template <class T>
+void calculate_contour_strips(T &iso, int threads) {
+  const int min_strip_rows = 16; // not worth splitting the grid any finer
+  int n_cell_rows = iso.nrow - 1;
+  int n_strips = min(threads, n_cell_rows / min_strip_rows);
+  if (n_strips < 2) {
+    iso.calculate_contour();
+    return;
+  }
+
+  vector<int> bounds = strip_bounds(n_cell_rows, n_strips);
+  iso.reset_grid();
+  vector<T> workers(n_strips, iso);
+  for (auto it = workers.begin(); it != workers.end(); it++) {
+    it->set_r_api(false);
+  }
+  vector<strip_topology> strips(n_strips, strip_topology(iso.ncol));
+
+  parallel_for(n_strips, n_strips, [&](int s, int) {
+    calculate_strip(workers[s], bounds, s, strips[s]);
+  }, [&]() {iso.check_interrupt();});
+
+  join_strips(iso, bounds, strips, false, nullptr);
+}
+
+// calculates multiple isobands in a single pass over the grid. Each cell is
+// classified once against the band limits, and elementary polygons are only
+// generated for the bands whose range overlaps the values at the cell corners.
+// Each band collects its polygons in its own isobander. Requires the bands to
+// be ordered such that both the low and the high limits are nondecreasing.
+// Disjoint ranges of bands can be calculated concurrently on different threads.
+class isoband_sweeper {
+protected:
+  int nrow, ncol;
+  cpp11::doubles grid_x, grid_y;
+  cpp11::sexp grid_z;
+  const void *grid_z_p;
+  value_type z_type;
+  vector<double> vlo, vhi; // low and high cutoff values for all bands
+  int n_bands;
+  vector<isobander> bands; // at least n_bands; any beyond are kept for reuse
+  const grid_ranges *ranges; // optional, for skipping tiles outside of all bands
+  path_filter filter; // for all bands
+  bool measure_paths;
+  bool record_parents;
+  bool r_api; // whether we may call into R; false when running on worker threads
+
+  // the sweep itself, for a grid of values of type T
+  template <class T>
+  void sweep(const T *z, int band_first, int band_last) {
+    // the grid is traversed in blocks of rows, see grid_store
+    for (int r0 = 0; r0 < nrow-1; r0 += grid_store::block_rows) {
+      int r1 = min(r0 + grid_store::block_rows, nrow - 1);
+      for (int i = band_first; i < band_last; i++) {
+        bands[i].polygon_grid.start_block(r0, r1);
+      }
+
+      for (int c = 0; c < ncol-1; c++) {
+        for (int i = band_first; i < band_last; i++) {
+          bands[i].polygon_grid.advance(c);
+        }
+
+        // with grid ranges, the column is split along the tile boundaries, and
+        // each piece is only checked against the bands overlapping its tile
+        for (int r_piece = r0; r_piece < r1; ) {
+          int r_end = ranges ? min(r1, (r_piece / grid_ranges::tile_size + 1) * grid_ranges::tile_size) : r1;
+          int piece_first = band_first, piece_last = band_last;
+          if (ranges) {
+            piece_first = upper_bound(vhi.begin() + band_first, vhi.begin() + band_last, ranges->min_at(r_piece, c)) - vhi.begin();
+            piece_last = upper_bound(vlo.begin() + band_first, vlo.begin() + band_last, ranges->max_at(r_piece, c)) - vlo.begin();
+          }
+
+          for (int r = r_piece; r < r_end && piece_first < piece_last; r++) {
+            double z0 = value_traits<T>::as_double(z[r + c * nrow]),
+                   z1 = value_traits<T>::as_double(z[r + (c + 1) * nrow]),
+                   z2 = value_traits<T>::as_double(z[r + 1 + (c + 1) * nrow]),
+                   z3 = value_traits<T>::as_double(z[r + 1 + c * nrow]);
+            if (!R_finite(z0) || !R_finite(z1) || !R_finite(z2) || !R_finite(z3)) {
+              // we don't draw any contours if at least one of the corners is NA
+              continue;
+            }
+
+            // all other bands have the cell entirely below (index 0) or
+            // entirely above (index 80) their range, and hence no contour
+            double zmin = min(min(z0, z1), min(z2, z3));
+            double zmax = max(max(z0, z1), max(z2, z3));
+            int first = upper_bound(vhi.begin() + piece_first, vhi.begin() + piece_last, zmin) - vhi.begin();
+            int last = upper_bound(vlo.begin() + piece_first, vlo.begin() + piece_last, zmax) - vlo.begin();
+
+            for (int i = first; i < last; i++) {
+              double lo = vlo[i], hi = vhi[i];
+              int index =
+                27*((z0 >= lo && z0 < hi) + 2*(z0 >= hi)) + 9*((z1 >= lo && z1 < hi) + 2*(z1 >= hi)) +
+                3*((z2 >= lo && z2 < hi) + 2*(z2 >= hi)) + ((z3 >= lo && z3 < hi) + 2*(z3 >= hi));
+              bands[i].elementary_polygons(r, c, index);
+            }
+          }
+          r_piece = r_end;
+        }
       }
+      if (r_api) cpp11::check_user_interrupt();
+    }
+  }
+
+public:
+  isoband_sweeper(cpp11::doubles x, cpp11::doubles y, cpp11::sexp z) :
+    nrow(Rf_nrows(z)), ncol(Rf_ncols(z)), grid_x(x), grid_y(y), grid_z(z),
+    grid_z_p(matrix_values(z)), z_type(matrix_value_type(z)), n_bands(0), ranges(nullptr),
+    measure_paths(false), record_parents(false), r_api(true) {}
+
+  // sets the bands to be calculated; the isobanders of earlier bands are reused,
+  // along with their memory
+  void set_values(const vector<double> &value_low, const vector<double> &value_high) {
+    vlo = value_low;
+    vhi = value_high;
+    n_bands = vlo.size();
+    while ((int)bands.size() < n_bands) {
+      bands.push_back(isobander(grid_x, grid_y, grid_z));
+      bands.back().set_r_api(r_api);
+      bands.back().set_path_filter(filter);
+      bands.back().set_measure_paths(measure_paths);
+      bands.back().set_record_parents(record_parents);
+    }
+    for (int i = 0; i < n_bands; i++) {
+      bands[i].set_value(vlo[i], vhi[i]);
+    }
+  }
+
+  void set_r_api(bool allowed) {
+    r_api = allowed;
+    for (auto it = bands.begin(); it != bands.end(); it++) {
+      it->set_r_api(allowed);
+    }
+  }
+
+  // see isobander::set_grid_ranges(), isobander::set_path_filter(),
+  // isobander::set_measure_paths(), isobander::set_record_parents(), and
+  // isobander::set_grid_values()
+  void set_grid_ranges(const grid_ranges *r) {ranges = r;}
+
+  void set_path_filter(const path_filter &f) {
+    filter = f;
+    for (auto it = bands.begin(); it != bands.end(); it++) {
+      it->set_path_filter(f);
+    }
+  }
+
+  void set_measure_paths(bool measure) {
+    measure_paths = measure;
+    for (auto it = bands.begin(); it != bands.end(); it++) {
+      it->set_measure_paths(measure);
+    }
+  }
+
+  void set_record_parents(bool record) {
+    record_parents = record;
+    for (auto it = bands.begin(); it != bands.end(); it++) {
+      it->set_record_parents(record);
+    }
+  }
+
+  void set_grid_values(cpp11::sexp z) {
+    grid_z = z;
+    grid_z_p = matrix_values(z);
+    for (auto it = bands.begin(); it != bands.end(); it++) {
+      it->set_grid_values(z);
+    }
+  }
+
+  void calculate_contours() {
+    calculate_contours(0, n_bands);
+  }
+
+  // calculates the bands band_first, ..., band_last-1 only
+  void calculate_contours(int band_first, int band_last) {
+    for (int i = band_first; i < band_last; i++) {
+      bands[i].reset_grid();
+      bands[i].keep_crossings = true;
+      // the lower boundary of a band is the upper boundary of the previous band
+      // if they meet, see isobander::lookup_point(). Only bands swept together
+      // share crossings; bands contoured separately interpolate their own,
+      // which gives bit-identical values.
+      bands[i].band_below = (i > band_first && vhi[i-1] == vlo[i]) ? &bands[i-1] : nullptr;
+    }
+
+    if (z_type == values_int32) {
+      sweep(static_cast<const int32_t *>(grid_z_p), band_first, band_last);
+    } else {
+      sweep(static_cast<const double *>(grid_z_p), band_first, band_last);
+    }
+  }
+
+  cpp11::writable::list collect(int band) {
+    return bands[band].collect();
+  }
+
+  void collect_paths(int band, contour_paths &paths) {
+    bands[band].collect_paths(paths);
+  }
+};
+
+// contours a grid of nrow x ncol values that is read in blocks of up to block_rows
+// rows by read_rows(first_row, n_rows, dest, stride), which stores the values of
+// the grid rows first_row, ..., first_row + n_rows - 1 column by column in dest,
+// with columns stride values apart. The values are of type Reader::element_type.
+// Readers that hold the whole grid column by column in memory return it from
+// column_major(), and the blocks are then contoured in place; others return null.
+// Only the current block plus the last row of the previous one are kept in memory,
+// along with the polygons or lines that are still open; finished ones are moved to
+// the output once enough of them have piled up, see isobander::collect_finished().
+// Each of the isobanders or isoliners in isos contours one level.
+template <class T, class Reader>
+cpp11::writable::list stream_contours(vector<T> &isos, Reader read_rows, int nrow, int ncol, int block_rows) {
+  typedef typename Reader::element_type V;
+  vector<contour_paths> paths(isos.size());
+  vector<V> rows, next_rows; // grid rows r0, ..., r0 + n - 1, column by column
+  int r0 = 0, n = 0;
+
+  const V *in_place = read_rows.column_major();
+
+  while (r0 + n < nrow) {
+    int n_read = min(block_rows, nrow - (r0 + n));
+
+    // carry over the last row of the previous block, which borders the new one
+    int n_keep = (n > 0) ? 1 : 0;
+    if (!in_place) {
+      next_rows.resize((size_t)(n_keep + n_read) * ncol);
+      if (n_keep) {
+        for (int c = 0; c < ncol; c++) {
+          next_rows[(size_t)c * (n_keep + n_read)] = rows[(size_t)c * n + n - 1];
+        }
+      }
+      read_rows(r0 + n, n_read, next_rows.data() + n_keep, n_keep + n_read);
+      rows.swap(next_rows);
+    }
+    r0 += n - n_keep;
+    n = n_keep + n_read;
+    if (n < 2) continue; // a single row has no cells
+
+    for (size_t k = 0; k < isos.size(); k++) {
+      if (in_place) {
+        isos[k].set_grid_rows(in_place + r0, r0, nrow);
+      } else {
+        isos[k].set_grid_rows(rows.data(), r0, n);
+      }
+      isos[k].calculate_rows(r0, r0 + n - 1);
+      isos[k].collect_finished(paths[k], r0 + n - 1);
+    }
+  }
+
+  cpp11::writable::list out;
+  out.reserve(isos.size());
+  for (size_t k = 0; k < isos.size(); k++) {
+    out.push_back(paths[k].as_list());
+  }
+  return out;
+}
+
+// grids from R can be double or integer matrices
+void check_grid_matrix(SEXP z) {
+  if (!Rf_isMatrix(z) || (TYPEOF(z) != REALSXP && TYPEOF(z) != INTSXP)) {
+    cpp11::stop("Grid values must be a numeric matrix.");
+  }
+}
+
+// contours a grid from R at any number of levels. Besides the grid, it holds
+// the value ranges of the grid tiles and the isobanders and isoliners doing the
+// work, whose buffers and point stores keep their memory from one call to the
+// next. isobands_impl() and isolines_impl() use a new one for every call;
+// iso_grid_impl() keeps one alive, so contouring the same grid again repeats
+// none of the setup.
+class grid_contourer {
+  cpp11::doubles grid_x, grid_y;
+  cpp11::sexp grid_z;
+  int nrow, ncol;
+  grid_ranges ranges;
+  isobander ib;
+  isoliner il;
+  isoband_sweeper sweeper;
+  vector<isobander> band_workers; // for calculating levels on worker threads
+  vector<isoliner> line_workers;
+  path_filter filter; // see set_path_filter()
+  bool measure_paths; // see set_measure_paths()
+  bool record_parents; // see set_record_parents()
+
+  // Once the grid has been updated, contours are calculated in horizontal strips
+  // (see calculate_strip()), whose topology is kept for the levels of the last
+  // call, along with the paths collected from them. When the same levels are
+  // contoured again, only the strips containing cells that have changed since
+  // are calculated again, and only the paths touching them are traced again;
+  // see strips_to_trace().
+  static const int update_strip_rows = 64;
+  bool updated;
+  vector<int> bounds; // strip boundaries, see strip_bounds()
+
+  // the paths of one level from the last call, and the strips each of them touches
+  struct traced_level {
+    bool valid = false;
+    contour_paths paths;
+    path_rows strips;
+  };
+
+  struct strip_cache {
+    vector<double> lo, hi; // levels of the kept contours
+    path_filter filter; // that the kept paths were selected with
+    bool measured = false; // whether the kept paths were measured
+    bool has_parents = false; // whether the kept paths come with their outer rings
+    vector<vector<strip_topology> > strips; // by level, then strip
+    vector<traced_level> traced; // by level
+    vector<char> dirty; // strips with changed cells
+  };
+  strip_cache band_cache, line_cache;
+
+  int strip_of(int cell_row) const {
+    int n_strips = bounds.size() - 1;
+    int s = upper_bound(bounds.begin(), bounds.end(), cell_row) - bounds.begin() - 1;
+    return min(max(s, 0), n_strips - 1);
+  }
+
+  // The strips whose paths have to be traced again: those that have changed,
+  // and all strips linked to them by paths of the last call, directly or through
+  // other strips. A path touches a contiguous run of strips, and it touches
+  // every cell row bordering one of its points, so paths can't connect strips
+  // from different runs of linked strips. The paths of the unchanged runs are
+  // therefore those of the last call, and the changed runs can be joined and
+  // traced by themselves.
+  vector<char> strips_to_trace(const traced_level &t, const vector<char> &dirty) const {
+    int n_strips = dirty.size();
+    if (!t.valid) return vector<char>(n_strips, 1);
+
+    // the last strip touched by any path starting in each strip
+    vector<int> reach(n_strips);
+    iota(reach.begin(), reach.end(), 0);
+    for (size_t i = 0; i < t.strips.first.size(); i++) {
+      reach[t.strips.first[i]] = max(reach[t.strips.first[i]], t.strips.last[i]);
+    }
+    for (size_t i = 0; i < t.strips.dropped_first.size(); i++) {
+      reach[t.strips.dropped_first[i]] = max(reach[t.strips.dropped_first[i]], t.strips.dropped_last[i]);
+    }
+
+    vector<char> trace(n_strips, 0);
+    for (int s = 0; s < n_strips; ) {
+      int end = reach[s];
+      bool changed = dirty[s];
+      for (int u = s + 1; u <= end; u++) {
+        end = max(end, reach[u]);
+        changed = changed || dirty[u];
+      }
+      fill(trace.begin() + s, trace.begin() + end + 1, changed);
+      s = end + 1;
+    }
+    return trace;
+  }
+
+  // replaces the paths of t in the strips marked in traced by paths, which
+  // touch the cell rows given in rows
+  void update_traced(traced_level &t, const vector<char> &traced, contour_paths &paths, const path_rows &rows) {
+    path_rows strips;
+    for (size_t i = 0; i < rows.first.size(); i++) {
+      strips.add(true, strip_of(rows.first[i]), strip_of(rows.last[i]));
+    }
+    for (size_t i = 0; i < rows.dropped_first.size(); i++) {
+      strips.add(false, strip_of(rows.dropped_first[i]), strip_of(rows.dropped_last[i]));
+    }
+    if (!t.valid || find(traced.begin(), traced.end(), 0) == traced.end()) {
+      swap(t.paths, paths);
+      swap(t.strips, strips);
+      t.valid = true;
+      return;
+    }
+
+    // the paths kept from the last call come first, then the new ones,
+    // numbered on from them. A hole touches some of the strips its outer ring
+    // touches, so the two are either both kept or both traced again.
+    contour_paths merged;
+    path_rows merged_strips;
+    merged.has_parents = paths.has_parents;
+    merged.measured = paths.measured;
+    vector<int> new_id(t.strips.first.size() + 1, 0);
+    int id = 0;
+    for (size_t k = 0; k < t.strips.first.size(); k++) {
+      if (!traced[t.strips.first[k]]) new_id[k + 1] = ++id;
+    }
+    R_xlen_t i = 0, n = t.paths.id.size();
+    for (size_t k = 0; k < t.strips.first.size(); k++) {
+      R_xlen_t end = i;
+      while (end < n && t.paths.id[end] == t.paths.id[i]) end++;
+      if (new_id[k + 1] > 0) {
+        merged.x.insert(merged.x.end(), t.paths.x.begin() + i, t.paths.x.begin() + end);
+        merged.y.insert(merged.y.end(), t.paths.y.begin() + i, t.paths.y.begin() + end);
+        merged.id.insert(merged.id.end(), end - i, new_id[k + 1]);
+        if (merged.has_parents) merged.parent.push_back(new_id[t.paths.parent[k]]);
+        if (merged.measured) merged.metrics.add(new_id[k + 1], t.paths.metrics, k);
+        merged_strips.add(true, t.strips.first[k], t.strips.last[k]);
+      }
+      i = end;
+    }
+    for (size_t k = 0; k < t.strips.dropped_first.size(); k++) {
+      if (!traced[t.strips.dropped_first[k]]) {
+        merged_strips.add(false, t.strips.dropped_first[k], t.strips.dropped_last[k]);
+      }
+    }
+
+    merged.x.insert(merged.x.end(), paths.x.begin(), paths.x.end());
+    merged.y.insert(merged.y.end(), paths.y.begin(), paths.y.end());
+    for (auto it = paths.id.begin(); it != paths.id.end(); it++) {
+      merged.id.push_back(*it + id);
+    }
+    for (auto it = paths.parent.begin(); it != paths.parent.end(); it++) {
+      merged.parent.push_back(*it + id);
+    }
+    for (size_t k = 0; k < strips.first.size(); k++) {
+      if (merged.measured) merged.metrics.add(id + k + 1, paths.metrics, k);
+      merged_strips.add(true, strips.first[k], strips.last[k]);
+    }
+    for (size_t k = 0; k < strips.dropped_first.size(); k++) {
+      merged_strips.add(false, strips.dropped_first[k], strips.dropped_last[k]);
+    }
+    swap(t.paths, merged);
+    swap(t.strips, merged_strips);
+  }
+
+  // makes sure there are at least n workers, which must not touch any R objects
+  template <class T>
+  void add_workers(vector<T> &workers, int n) {
+    while ((int)workers.size() < n) {
+      workers.push_back(T(grid_x, grid_y, grid_z));
+      workers.back().set_r_api(false);
+      workers.back().set_grid_ranges(&ranges);
+      workers.back().set_path_filter(filter);
+      workers.back().set_measure_paths(measure_paths);
+      workers.back().set_record_parents(record_parents);
+    }
+  }
+
+  // contours the levels lo[k] to hi[k] (isobands) or lo[k] (isolines) from the
+  // strips in cache, calculating only those that are dirty or not there yet, and
+  // tracing only the paths that may have changed
+  template <class T>
+  cpp11::writable::list contour_updated(T &iso, vector<T> &workers, strip_cache &cache,
+                                        const vector<double> &lo, const vector<double> &hi, int threads) {
+    int n_levels = lo.size(), n_strips = bounds.size() - 1;
+    if (cache.lo != lo || cache.hi != hi) {
+      cache.lo = lo;
+      cache.hi = hi;
+      cache.strips.assign(n_levels, vector<strip_topology>(n_strips, strip_topology(ncol)));
+      cache.traced.assign(n_levels, traced_level());
+      fill(cache.dirty.begin(), cache.dirty.end(), 1);
+    }
+    if (cache.filter != filter || cache.measured != measure_paths || cache.has_parents != record_parents) {
+      cache.filter = filter;
+      cache.measured = measure_paths;
+      cache.has_parents = record_parents;
+      for (auto it = cache.traced.begin(); it != cache.traced.end(); it++) it->valid = false;
+    }
+
+    auto contour_level = [&](T &w, int k) {
+      set_level(w, lo[k], hi[k]);
+      for (int s = 0; s < n_strips; s++) {
+        if (cache.dirty[s]) calculate_strip(w, bounds, s, cache.strips[k][s]);
+      }
+      traced_level &t = cache.traced[k];
+      vector<char> traced = strips_to_trace(t, cache.dirty);
+      join_strips(w, bounds, cache.strips[k], true, &traced);
+      contour_paths paths;
+      path_rows rows;
+      w.collect_paths(paths, &rows);
+      update_traced(t, traced, paths, rows);
+    };
+
+    if (threads > 1 && n_levels > 1) {
+      threads = min(threads, n_levels);
+      add_workers(workers, threads);
+      parallel_for(n_levels, threads, [&](int k, int worker) {
+        contour_level(workers[worker], k);
+      }, []() {cpp11::check_user_interrupt();});
+    } else {
+      for (int k = 0; k < n_levels; k++) {
+        contour_level(iso, k);
+      }
+    }
+
+    cpp11::writable::list out;
+    out.reserve(n_levels);
+    for (int k = 0; k < n_levels; k++) {
+      out.push_back(cache.traced[k].paths.as_list());
+    }
+    fill(cache.dirty.begin(), cache.dirty.end(), 0);
+    return out;
+  }
+
+  // calculates the statistics of the levels lo[k] to hi[k] (isobands) or lo[k]
+  // (isolines), see isobander::calculate_stats(), with one level per task
+  template <class T>
+  cpp11::writable::list level_stats(T &iso, vector<T> &workers, const vector<double> &lo, const vector<double> &hi, int threads) {
+    int n_levels = lo.size();
+    vector<contour_stats> stats(n_levels);
+    if (threads > 1 && n_levels > 1) {
+      threads = min(threads, n_levels);
+      add_workers(workers, threads);
+      parallel_for(n_levels, threads, [&](int k, int worker) {
+        set_level(workers[worker], lo[k], hi[k]);
+        stats[k] = workers[worker].calculate_stats();
+      }, []() {cpp11::check_user_interrupt();});
+    } else {
+      for (int k = 0; k < n_levels; k++) {
+        set_level(iso, lo[k], hi[k]);
+        stats[k] = iso.calculate_stats();
+      }
+    }
+
+    cpp11::writable::doubles area(n_levels), length(n_levels), cells(n_levels), boundary_cells(n_levels);
+    for (int k = 0; k < n_levels; k++) {
+      area[k] = stats[k].area;
+      length[k] = stats[k].length;
+      cells[k] = stats[k].cells;
+      boundary_cells[k] = stats[k].boundary_cells;
     }
     return cpp11::writable::list({
-      "x"_nm = x_out,
-      "y"_nm = y_out,
-      "id"_nm = id
+      "area"_nm = area,
+      "length"_nm = length,
+      "cells"_nm = cells,
+      "boundary_cells"_nm = boundary_cells
     });
   }
+
+public:
+  // z must have passed check_grid_matrix()
+  grid_contourer(cpp11::doubles x, cpp11::doubles y, cpp11::sexp z) :
+    grid_x(x), grid_y(y), grid_z(z), nrow(Rf_nrows(z)), ncol(Rf_ncols(z)),
+    ranges(matrix_values(z), matrix_value_type(z), nrow, ncol),
+    ib(x, y, z), il(x, y, z), sweeper(x, y, z), measure_paths(false),
+    record_parents(false), updated(false)
+  {
+    ib.set_grid_ranges(&ranges);
+    il.set_grid_ranges(&ranges);
+    sweeper.set_grid_ranges(&ranges);
+  }
+
+  // the isobanders and isoliners point to ranges
+  grid_contourer(const grid_contourer &) = delete;
+  grid_contourer &operator=(const grid_contourer &) = delete;
+
+  // leaves the polygon rings and lines selected by f out of the contours
+  void set_path_filter(const path_filter &f) {
+    filter = f;
+    ib.set_path_filter(f);
+    il.set_path_filter(f);
+    sweeper.set_path_filter(f);
+    for (auto it = band_workers.begin(); it != band_workers.end(); it++) it->set_path_filter(f);
+    for (auto it = line_workers.begin(); it != line_workers.end(); it++) it->set_path_filter(f);
+  }
+
+  // adds the measurements of every polygon ring or line to the contours
+  void set_measure_paths(bool measure) {
+    measure_paths = measure;
+    ib.set_measure_paths(measure);
+    il.set_measure_paths(measure);
+    sweeper.set_measure_paths(measure);
+    for (auto it = band_workers.begin(); it != band_workers.end(); it++) it->set_measure_paths(measure);
+    for (auto it = line_workers.begin(); it != line_workers.end(); it++) it->set_measure_paths(measure);
+  }
+
+  // adds the outer ring of every polygon ring to the isobands; isolines have none
+  void set_record_parents(bool record) {
+    record_parents = record;
+    ib.set_record_parents(record);
+    sweeper.set_record_parents(record);
+    for (auto it = band_workers.begin(); it != band_workers.end(); it++) it->set_record_parents(record);
+  }
+
+  // replaces the values of the grid points in rows row0, ..., row0 + nrow(values) - 1
+  // and columns col0, ..., col0 + ncol(values) - 1 by values, a matrix of the same
+  // type as the grid. The grid is copied on the first update, so the R matrix it
+  // came from never changes.
+  void update(int row0, int col0, cpp11::sexp values) {
+    if (!Rf_isMatrix(values) || TYPEOF(values) != TYPEOF(grid_z)) {
+      cpp11::stop("Updated values must be a matrix of the same type as the grid.");
+    }
+    int nr = Rf_nrows(values), nc = Rf_ncols(values);
+    if (row0 < 0 || col0 < 0 || row0 + nr > nrow || col0 + nc > ncol) {
+      cpp11::stop("Updated values must lie within the grid.");
+    }
+    if (nr == 0 || nc == 0) return;
+
+    if (!updated) {
+      grid_z = cpp11::safe[Rf_duplicate](grid_z);
+      ib.set_grid_values(grid_z);
+      il.set_grid_values(grid_z);
+      sweeper.set_grid_values(grid_z);
+      for (auto it = band_workers.begin(); it != band_workers.end(); it++) it->set_grid_values(grid_z);
+      for (auto it = line_workers.begin(); it != line_workers.end(); it++) it->set_grid_values(grid_z);
+
+      int n_cell_rows = max(nrow - 1, 0);
+      bounds = strip_bounds(n_cell_rows, max(n_cell_rows / update_strip_rows, 1));
+      band_cache.dirty.assign(bounds.size() - 1, 1);
+      line_cache.dirty.assign(bounds.size() - 1, 1);
+      updated = true;
+    }
+
+    size_t size = (TYPEOF(grid_z) == INTSXP) ? sizeof(int) : sizeof(double);
+    const char *from = static_cast<const char *>(matrix_values(values));
+    char *to = const_cast<char *>(static_cast<const char *>(matrix_values(grid_z)));
+    for (int c = 0; c < nc; c++) {
+      memcpy(to + ((size_t)(col0 + c) * nrow + row0) * size, from + (size_t)c * nr * size, nr * size);
+    }
+    ranges.update(matrix_values(grid_z), matrix_value_type(grid_z), row0, row0 + nr - 1, col0, col0 + nc - 1);
+
+    // the changed grid points are corners of the cells in rows row0 - 1, ..., row0 + nr - 1
+    for (unsigned int s = 0; s + 1 < bounds.size(); s++) {
+      if (bounds[s] <= row0 + nr - 1 && bounds[s+1] > row0 - 1) {
+        band_cache.dirty[s] = line_cache.dirty[s] = 1;
+      }
+    }
+  }
+
+  cpp11::writable::list isobands(cpp11::doubles value_low, cpp11::doubles value_high, int threads) {
+    int n_bands = value_low.size();
+    if (n_bands != value_high.size()) {
+      cpp11::stop("Vectors of low and high values must have the same number of elements.");
+    }
+    if (updated) {
+      vector<double> lo(REAL(value_low), REAL(value_low) + n_bands), hi(REAL(value_high), REAL(value_high) + n_bands);
+      return contour_updated(ib, band_workers, band_cache, lo, hi, threads);
+    }
+
+    // bands can be calculated in a single sweep if they can be ordered such that
+    // both limits are nondecreasing; this holds for any set of non-overlapping bands
+    vector<int> order(n_bands);
+    iota(order.begin(), order.end(), 0);
+    bool sweep = true;
+    for (int i = 0; i < n_bands; ++i) {
+      if (ISNAN(value_low[i]) || ISNAN(value_high[i])) sweep = false;
+    }
+    if (sweep) {
+      stable_sort(order.begin(), order.end(), [&](int i, int j) {
+        return value_low[i] < value_low[j] || (value_low[i] == value_low[j] && value_high[i] < value_high[j]);
+      });
+      for (int k = 1; k < n_bands; ++k) {
+        if (value_high[order[k]] < value_high[order[k-1]]) sweep = false;
+      }
+    }
+
+    vector<double> lo(n_bands), hi(n_bands);
+    vector<int> rank(n_bands); // position of each band in the sorted order
+    for (int k = 0; k < n_bands; ++k) {
+      lo[k] = value_low[order[k]];
+      hi[k] = value_high[order[k]];
+      rank[order[k]] = k;
+    }
+
+    cpp11::writable::list out;
+    out.reserve(n_bands);
+
+    if (threads > 1 && n_bands >= threads) {
+      // bands are calculated on worker threads, which must not touch any R
+      // objects; conversion of the results into R objects happens at the end
+      threads = min(threads, n_bands);
+      vector<contour_paths> paths(n_bands);
+
+      if (sweep) {
+        sweeper.set_values(lo, hi);
+        sweeper.set_r_api(false);
+        // each task sweeps over a group of consecutive bands. Every group pays
+        // for a pass over the grid, but bands near the bulk of the values cost
+        // far more than those in the tails, so the groups are handed out a few
+        // per thread, to threads as they become free
+        const int groups_per_thread = 4;
+        int group_size = max(1, n_bands / (groups_per_thread * threads));
+        int n_groups = (n_bands + group_size - 1) / group_size;
+        parallel_for(n_groups, threads, [&](int group, int) {
+          int first = group * group_size;
+          int last = min(first + group_size, n_bands);
+          sweeper.calculate_contours(first, last);
+          for (int k = first; k < last; ++k) {
+            sweeper.collect_paths(k, paths[order[k]]);
+          }
+        }, []() {cpp11::check_user_interrupt();});
+      } else {
+        // bands that overlap are contoured one by one and don't share their
+        // crossings, see isoband_sweeper::calculate_contours()
+        add_workers(band_workers, threads);
+        parallel_for(n_bands, threads, [&](int k, int worker) {
+          isobander &w = band_workers[worker];
+          w.set_value(lo[k], hi[k]);
+          w.calculate_contour();
+          w.collect_paths(paths[order[k]]);
+        }, []() {cpp11::check_user_interrupt();});
+      }
+
+      for (int i = 0; i < n_bands; ++i) {
+        out.push_back(paths[i].as_list());
+      }
+    } else if (threads > 1) {
+      // too few bands to keep all threads busy; split the grid instead
+      for (int i = 0; i < n_bands; ++i) {
+        ib.set_value(value_low[i], value_high[i]);
+        calculate_contour_strips(ib, threads);
+        out.push_back(ib.collect());
+      }
+    } else if (sweep) {
+      sweeper.set_values(lo, hi);
+      sweeper.set_r_api(true);
+      sweeper.calculate_contours();
+      for (int i = 0; i < n_bands; ++i) {
+        out.push_back(sweeper.collect(rank[i]));
+      }
+    } else {
+      for (int i = 0; i < n_bands; ++i) {
+        ib.set_value(value_low[i], value_high[i]);
+        ib.calculate_contour();
+        out.push_back(ib.collect());
+      }
+    }
+
+    return out;
+  }
+
+  cpp11::writable::list isolines(cpp11::doubles value, int threads) {
+    int n_lines = value.size();
+    if (updated) {
+      vector<double> levels(REAL(value), REAL(value) + n_lines);
+      return contour_updated(il, line_workers, line_cache, levels, levels, threads);
+    }
+
+    cpp11::writable::list out;
+    out.reserve(n_lines);
+
+    if (threads > 1 && n_lines >= threads) {
+      // see isobands() for the threading setup
+      threads = min(threads, n_lines);
+      vector<double> levels(REAL(value), REAL(value) + n_lines);
+      vector<contour_paths> paths(n_lines);
+
+      add_workers(line_workers, threads);
+      parallel_for(n_lines, threads, [&](int i, int worker) {
+        isoliner &w = line_workers[worker];
+        w.set_value(levels[i]);
+        w.calculate_contour();
+        w.collect_paths(paths[i]);
+      }, []() {cpp11::check_user_interrupt();});
+
+      for (int i = 0; i < n_lines; ++i) {
+        out.push_back(paths[i].as_list());
+      }
+    } else {
+      for (int i = 0; i < n_lines; ++i) {
+        il.set_value(REAL(value)[i]);
+        if (threads > 1) {
+          calculate_contour_strips(il, threads);
+        } else {
+          il.calculate_contour();
+        }
+        out.push_back(il.collect());
+      }
+    }
+
+    return out;
+  }
+
+  cpp11::writable::list isobands_stats(cpp11::doubles value_low, cpp11::doubles value_high, int threads) {
+    int n_bands = value_low.size();
+    if (n_bands != value_high.size()) {
+      cpp11::stop("Vectors of low and high values must have the same number of elements.");
+    }
+    vector<double> lo(REAL(value_low), REAL(value_low) + n_bands), hi(REAL(value_high), REAL(value_high) + n_bands);
+    return level_stats(ib, band_workers, lo, hi, threads);
+  }
+
+  cpp11::writable::list isolines_stats(cpp11::doubles value, int threads) {
+    vector<double> levels(REAL(value), REAL(value) + value.size());
+    return level_stats(il, line_workers, levels, levels, threads);
+  }
 };
 
+path_filter make_path_filter(double min_area, int min_vertices) {
+  path_filter f;
+  f.min_area = min_area;
+  f.min_vertices = min_vertices;
+  return f;
+}
+
 [[cpp11::register]]
-cpp11::writable::list isobands_impl(cpp11::doubles x, cpp11::doubles y, cpp11::doubles_matrix<> z, cpp11::doubles value_low, cpp11::doubles value_high) {
-  isobander ib(x, y, z);
+cpp11::writable::list isobands_impl(cpp11::doubles x, cpp11::doubles y, cpp11::sexp z, cpp11::doubles value_low, cpp11::doubles value_high, int threads,
+                                    double min_area, int min_vertices, bool metrics, bool parent) {
+  check_grid_matrix(z);
+  grid_contourer contourer(x, y, z);
+  contourer.set_path_filter(make_path_filter(min_area, min_vertices));
+  contourer.set_measure_paths(metrics);
+  contourer.set_record_parents(parent);
+  return contourer.isobands(value_low, value_high, threads);
+}
 
-  int n_bands = value_low.size();
-  if (n_bands != value_high.size()) {
-    cpp11::stop("Vectors of low and high values must have the same number of elements.");
+[[cpp11::register]]
+cpp11::writable::list isolines_impl(cpp11::doubles x, cpp11::doubles y, cpp11::sexp z, cpp11::doubles value, int threads,
+                                    double min_area, int min_vertices, bool metrics) {
+  check_grid_matrix(z);
+  grid_contourer contourer(x, y, z);
+  contourer.set_path_filter(make_path_filter(min_area, min_vertices));
+  contourer.set_measure_paths(metrics);
+  return contourer.isolines(value, threads);
+}
+
+[[cpp11::register]]
+cpp11::writable::list isobands_stats_impl(cpp11::doubles x, cpp11::doubles y, cpp11::sexp z, cpp11::doubles value_low, cpp11::doubles value_high, int threads) {
+  check_grid_matrix(z);
+  grid_contourer contourer(x, y, z);
+  return contourer.isobands_stats(value_low, value_high, threads);
+}
+
+[[cpp11::register]]
+cpp11::writable::list isolines_stats_impl(cpp11::doubles x, cpp11::doubles y, cpp11::sexp z, cpp11::doubles value, int threads) {
+  check_grid_matrix(z);
+  grid_contourer contourer(x, y, z);
+  return contourer.isolines_stats(value, threads);
+}
+
+// a grid_contourer that lives as long as the R object holding it, see iso_grid()
+[[cpp11::register]]
+SEXP iso_grid_impl(cpp11::doubles x, cpp11::doubles y, cpp11::sexp z) {
+  check_grid_matrix(z);
+  return cpp11::external_pointer<grid_contourer>(new grid_contourer(x, y, z));
+}
+
+grid_contourer &grid_contourer_at(SEXP grid) {
+  if (TYPEOF(grid) != EXTPTRSXP) {
+    cpp11::stop("Invalid grid handle.");
   }
+  grid_contourer *contourer = cpp11::external_pointer<grid_contourer>(grid).get();
+  if (!contourer) {
+    // external pointers don't survive saving and reloading
+    cpp11::stop("The grid handle is no longer valid; it has to be created again with iso_grid().");
+  }
+  return *contourer;
+}
+
+[[cpp11::register]]
+void iso_grid_update_impl(cpp11::sexp grid, int row0, int col0, cpp11::sexp values) {
+  grid_contourer_at(grid).update(row0, col0, values);
+}
+
+[[cpp11::register]]
+cpp11::writable::list isobands_grid_impl(cpp11::sexp grid, cpp11::doubles value_low, cpp11::doubles value_high, int threads,
+                                         double min_area, int min_vertices, bool metrics, bool parent) {
+  grid_contourer &contourer = grid_contourer_at(grid);
+  contourer.set_path_filter(make_path_filter(min_area, min_vertices));
+  contourer.set_measure_paths(metrics);
+  contourer.set_record_parents(parent);
+  return contourer.isobands(value_low, value_high, threads);
+}
+
+[[cpp11::register]]
+cpp11::writable::list isolines_grid_impl(cpp11::sexp grid, cpp11::doubles value, int threads,
+                                         double min_area, int min_vertices, bool metrics) {
+  grid_contourer &contourer = grid_contourer_at(grid);
+  contourer.set_path_filter(make_path_filter(min_area, min_vertices));
+  contourer.set_measure_paths(metrics);
+  return contourer.isolines(value, threads);
+}
 
-  ib.calculate_contour();
+// a list with a list of the paths of every level for each grid
+cpp11::writable::list nested_path_lists(const vector<vector<contour_paths> > &paths) {
   cpp11::writable::list out;
-  out.reserve(n_bands);
+  out.reserve(paths.size());
+  for (auto it = paths.begin(); it != paths.end(); it++) {
+    cpp11::writable::list levels;
+    levels.reserve(it->size());
+    for (auto level = it->begin(); level != it->end(); level++) {
+      levels.push_back(level->as_list());
+    }
+    out.push_back(levels);
+  }
+  return out;
+}
 
-  for (int i = 0; i < n_bands; ++i) {
-    ib.set_value(value_low[i], value_high[i]);
-    ib.calculate_contour();
-    out.push_back(ib.collect());
+// Stacks of grids, such as the frames of a forecast, are contoured frame by
+// frame at the same levels. Consecutive frames tend to be alike, so the contours
+// are calculated in strips (see calculate_strip()), which are kept from one
+// frame to the next along with the codes of their cells. A strip whose cells
+// have the same codes as in the previous frame has the same topology, whatever
+// the grid values, and is used as it is; the coordinates of its points are
+// calculated from the current frame when the paths are collected.
+const int stack_strip_rows = 32;
+
+// grid stacks from R are double or integer arrays with three dimensions
+void check_grid_stack(SEXP z) {
+  if (Rf_length(Rf_getAttrib(z, R_DimSymbol)) != 3 || (TYPEOF(z) != REALSXP && TYPEOF(z) != INTSXP)) {
+    cpp11::stop("Grid values must be a numeric array with three dimensions.");
   }
+}
 
-  return out;
+// contours the frames f_first, ..., f_last-1 of a grid stack with iso, at the
+// levels lo[k] to hi[k] (isobands) or lo[k] (isolines), and stores the paths of
+// level k in frame f in paths[f][k]. The frames are nrow x ncol values of the
+// given type, frame_bytes apart from z on.
+template <class T>
+void contour_frames(T &iso, int nrow, int ncol, const char *z, value_type type, size_t frame_bytes,
+                    const vector<double> &lo, const vector<double> &hi, int f_first, int f_last,
+                    vector<vector<contour_paths> > &paths) {
+  int n_levels = lo.size();
+  int n_cell_rows = max(nrow - 1, 0), n_cell_cols = max(ncol - 1, 0);
+  vector<int> bounds = strip_bounds(n_cell_rows, max(n_cell_rows / stack_strip_rows, 1));
+  int n_strips = bounds.size() - 1;
+
+  // by level, then strip
+  vector<vector<strip_topology> > strips(n_levels, vector<strip_topology>(n_strips, strip_topology(ncol)));
+  vector<vector<vector<unsigned char> > > codes(n_levels, vector<vector<unsigned char> >(n_strips));
+  vector<unsigned char> frame_codes;
+
+  for (int f = f_first; f < f_last; f++) {
+    const char *frame = z + f * frame_bytes;
+    grid_ranges ranges(frame, type, nrow, ncol);
+    iso.set_grid_pointer(frame, type);
+    iso.set_grid_ranges(&ranges);
+    for (int k = 0; k < n_levels; k++) {
+      set_level(iso, lo[k], hi[k]);
+      for (int s = 0; s < n_strips; s++) {
+        // the seam row of the strip is processed by join_strips()
+        int r_first = bounds[s] + (s > 0), r_last = bounds[s+1];
+        frame_codes.assign((size_t)max(r_last - r_first, 0) * n_cell_cols, 0);
+        iso.row_codes(r_first, r_last, frame_codes.data());
+        if (f == f_first || frame_codes != codes[k][s]) {
+          calculate_strip(iso, bounds, s, strips[k][s]);
+          codes[k][s].swap(frame_codes);
+        }
+      }
+      join_strips(iso, bounds, strips[k], true, nullptr);
+      iso.collect_paths(paths[f][k]);
+    }
+  }
+}
+
+// contours all frames of the grid stack z on up to `threads` threads, each
+// taking a run of consecutive frames; returns a list with the paths of all
+// levels for each frame
+template <class T>
+cpp11::writable::list stack_contours(cpp11::doubles x, cpp11::doubles y, cpp11::sexp z,
+                                     const vector<double> &lo, const vector<double> &hi, int threads) {
+  check_grid_stack(z);
+  cpp11::integers dim(Rf_getAttrib(z, R_DimSymbol));
+  int nrow = dim[0], ncol = dim[1], n_frames = dim[2];
+  value_type type = matrix_value_type(z);
+  size_t frame_bytes = (size_t)nrow * ncol * (type == values_int32 ? sizeof(int32_t) : sizeof(double));
+  const char *values = static_cast<const char *>(matrix_values(z));
+
+  threads = max(min(threads, n_frames), 1);
+  vector<T> workers;
+  workers.reserve(threads);
+  for (int i = 0; i < threads; i++) {
+    workers.push_back(T(x, y, nrow, ncol));
+    workers.back().set_r_api(threads == 1);
+  }
+
+  vector<vector<contour_paths> > paths(n_frames, vector<contour_paths>(lo.size()));
+  parallel_for(threads, threads, [&](int i, int worker) {
+    int f_first = (long long)n_frames * i / threads, f_last = (long long)n_frames * (i + 1) / threads;
+    contour_frames(workers[worker], nrow, ncol, values, type, frame_bytes, lo, hi, f_first, f_last, paths);
+  }, []() {cpp11::check_user_interrupt();});
+
+  return nested_path_lists(paths);
 }
 
 [[cpp11::register]]
-cpp11::writable::list isolines_impl(cpp11::doubles x, cpp11::doubles y, cpp11::doubles_matrix<> z, cpp11::doubles value) {
-  isoliner il(x, y, z);
+cpp11::writable::list isobands_stack_impl(cpp11::doubles x, cpp11::doubles y, cpp11::sexp z, cpp11::doubles value_low, cpp11::doubles value_high, int threads) {
+  if (value_low.size() != value_high.size()) {
+    cpp11::stop("Vectors of low and high values must have the same number of elements.");
+  }
+  vector<double> lo(value_low.begin(), value_low.end()), hi(value_high.begin(), value_high.end());
+  return stack_contours<isobander>(x, y, z, lo, hi, threads);
+}
 
+[[cpp11::register]]
+cpp11::writable::list isolines_stack_impl(cpp11::doubles x, cpp11::doubles y, cpp11::sexp z, cpp11::doubles value, int threads) {
+  vector<double> levels(value.begin(), value.end());
+  return stack_contours<isoliner>(x, y, z, levels, levels, threads);
+}
+
+// Many small grids, such as the members of an ensemble or the panels of a
+// faceted plot, are contoured in a single call, so that going back and forth
+// between R and C++ is paid for once rather than for every grid. The grids are
+// handed out to the threads one at a time, and each thread contours all of its
+// grids with the same isobander or isoliner, which keeps its memory from one
+// grid to the next.
+struct batch_grid {
+  const double *x, *y;
+  int nrow, ncol;
+  const void *z;
+  value_type type;
+};
+
+// contours the grids with coordinates x[[i]] and y[[i]] and values z[[i]] at the
+// levels lo[k] to hi[k] (isobands) or lo[k] (isolines); returns a list with the
+// paths of all levels for each grid
+template <class T>
+cpp11::writable::list batch_contours(cpp11::list x, cpp11::list y, cpp11::list z,
+                                     const vector<double> &lo, const vector<double> &hi, int threads) {
+  int n_grids = z.size();
+  if (x.size() != n_grids || y.size() != n_grids) {
+    cpp11::stop("Lists of x coordinates, y coordinates, and grid values must have the same length.");
+  }
+
+  vector<batch_grid> grids(n_grids);
+  for (int i = 0; i < n_grids; i++) {
+    SEXP xi = x[i], yi = y[i], zi = z[i];
+    check_grid_matrix(zi);
+    if (TYPEOF(xi) != REALSXP || TYPEOF(yi) != REALSXP) {
+      cpp11::stop("Grid coordinates must be double vectors.");
+    }
+    batch_grid &g = grids[i];
+    g.nrow = Rf_nrows(zi);
+    g.ncol = Rf_ncols(zi);
+    if (Rf_xlength(xi) != g.ncol) {cpp11::stop("Number of x coordinates must match number of columns in density matrix %d.", i + 1);}
+    if (Rf_xlength(yi) != g.nrow) {cpp11::stop("Number of y coordinates must match number of rows in density matrix %d.", i + 1);}
+    g.x = REAL(xi);
+    g.y = REAL(yi);
+    g.z = matrix_values(zi);
+    g.type = matrix_value_type(zi);
+  }
+  if (n_grids == 0) return cpp11::writable::list();
+
+  threads = max(min(threads, n_grids), 1);
+  vector<T> workers;
+  workers.reserve(threads);
+  for (int i = 0; i < threads; i++) {
+    workers.push_back(T(x[0], y[0], grids[0].nrow, grids[0].ncol));
+    workers.back().set_r_api(threads == 1);
+  }
+
+  vector<vector<contour_paths> > paths(n_grids, vector<contour_paths>(lo.size()));
+  parallel_for(n_grids, threads, [&](int i, int worker) {
+    T &iso = workers[worker];
+    const batch_grid &g = grids[i];
+    iso.set_grid(g.x, g.y, g.nrow, g.ncol, g.z, g.type);
+    for (size_t k = 0; k < lo.size(); k++) {
+      set_level(iso, lo[k], hi[k]);
+      iso.calculate_contour();
+      iso.collect_paths(paths[i][k]);
+    }
+  }, []() {cpp11::check_user_interrupt();});
+
+  return nested_path_lists(paths);
+}
+
+[[cpp11::register]]
+cpp11::writable::list isobands_batch_impl(cpp11::list x, cpp11::list y, cpp11::list z, cpp11::doubles value_low, cpp11::doubles value_high, int threads) {
+  if (value_low.size() != value_high.size()) {
+    cpp11::stop("Vectors of low and high values must have the same number of elements.");
+  }
+  vector<double> lo(value_low.begin(), value_low.end()), hi(value_high.begin(), value_high.end());
+  return batch_contours<isobander>(x, y, z, lo, hi, threads);
+}
+
+[[cpp11::register]]
+cpp11::writable::list isolines_batch_impl(cpp11::list x, cpp11::list y, cpp11::list z, cpp11::doubles value, int threads) {
+  vector<double> levels(value.begin(), value.end());
+  return batch_contours<isoliner>(x, y, z, levels, levels, threads);
+}
+
+// contours the bands value_low[i] to value_high[i] of a grid read by read_rows(),
+// see stream_contours()
+template <class Reader>
+cpp11::writable::list stream_isobands(cpp11::doubles x, cpp11::doubles y, cpp11::doubles value_low, cpp11::doubles value_high, Reader read_rows, int block_rows) {
+  int n_bands = value_low.size();
+  if (n_bands != value_high.size()) {
+    cpp11::stop("Vectors of low and high values must have the same number of elements.");
+  }
+
+  vector<isobander> bands;
+  bands.reserve(n_bands);
+  for (int i = 0; i < n_bands; ++i) {
+    bands.push_back(isobander(x, y, y.size(), x.size(), value_low[i], value_high[i]));
+  }
+  return stream_contours(bands, read_rows, y.size(), x.size(), block_rows);
+}
+
+// contours the lines at value[i] of a grid read by read_rows(), see stream_contours()
+template <class Reader>
+cpp11::writable::list stream_isolines(cpp11::doubles x, cpp11::doubles y, cpp11::doubles value, Reader read_rows, int block_rows) {
   int n_lines = value.size();
-  cpp11::writable::list out;
-  out.reserve(n_lines);
 
+  vector<isoliner> lines;
+  lines.reserve(n_lines);
   for (int i = 0; i < n_lines; ++i) {
-    il.set_value(REAL(value)[i]);
-    il.calculate_contour();
-    out.push_back(il.collect());
+    lines.push_back(isoliner(x, y, y.size(), x.size(), value[i]));
   }
+  return stream_contours(lines, read_rows, y.size(), x.size(), block_rows);
+}
 
-  return out;
+// reads grid rows through an R function returning them as a matrix; the function
+// receives the first row (counting from 1) and the number of rows
+struct r_row_reader {
+  typedef double element_type;
+  cpp11::function read_rows;
+
+  void operator()(int first_row, int n_rows, double *dest, int stride) const {
+    cpp11::doubles_matrix<> block(read_rows(first_row + 1, n_rows));
+    int ncol = block.ncol();
+    for (int c = 0; c < ncol; c++) {
+      const double *col = REAL(block) + (size_t)c * n_rows;
+      copy(col, col + n_rows, dest + (size_t)c * stride);
+    }
+  }
+
+  const double *column_major() const {return nullptr;}
+};
+
+// reads grid rows from a memory-mapped file of values of type V, stored row by row
+// or column by column, in either byte order. Values stored column by column in
+// this machine's byte order are usable as they are, and column_major() hands them
+// to stream_contours() to be contoured straight from the mapped pages.
+template <class V>
+struct mapped_row_reader {
+  typedef V element_type;
+  const unsigned char *data;
+  int nrow, ncol;
+  bool swap;     // whether the byte order differs from this machine's
+  bool byrow;    // whether the values are stored row by row
+
+  V value_at(size_t i) const {
+    unsigned char bytes[sizeof(V)];
+    const unsigned char *p = data + i * sizeof(V);
+    if (swap) {
+      for (size_t k = 0; k < sizeof(V); k++) bytes[k] = p[sizeof(V) - 1 - k];
+      p = bytes;
+    }
+    V v;
+    memcpy(&v, p, sizeof(V));
+    return v;
+  }
+
+  void operator()(int first_row, int n_rows, V *dest, int stride) const {
+    for (int r = 0; r < n_rows; r++) {
+      for (int c = 0; c < ncol; c++) {
+        size_t i = byrow ? (size_t)(first_row + r) * ncol + c : (size_t)c * nrow + first_row + r;
+        dest[r + (size_t)c * stride] = value_at(i);
+      }
+    }
+  }
+
+  const V *column_major() const {
+    return (swap || byrow) ? nullptr : reinterpret_cast<const V *>(data);
+  }
+};
+
+[[cpp11::register]]
+cpp11::writable::list isobands_stream_impl(cpp11::doubles x, cpp11::doubles y, cpp11::function read_rows, cpp11::doubles value_low, cpp11::doubles value_high, int block_rows) {
+  return stream_isobands(x, y, value_low, value_high, r_row_reader{read_rows}, block_rows);
+}
+
+[[cpp11::register]]
+cpp11::writable::list isolines_stream_impl(cpp11::doubles x, cpp11::doubles y, cpp11::function read_rows, cpp11::doubles value, int block_rows) {
+  return stream_isolines(x, y, value, r_row_reader{read_rows}, block_rows);
+}
+
+// the type of the values in a file, given as in readBin(): integers of 2 or 4 bytes,
+// or floating point numbers of 4 or 8 bytes
+value_type file_value_type(bool integer, int size) {
+  if (integer && size == 2) return values_int16;
+  if (integer && size == 4) return values_int32;
+  if (!integer && size == 4) return values_float;
+  if (!integer && size == 8) return values_double;
+  cpp11::stop("Values must be integers of 2 or 4 bytes or floating point numbers of 4 or 8 bytes.");
+}
+
+// checks that a file holds an nrow x ncol grid of values of type V and sets up
+// a reader for it; the file must stay mapped while the reader is used
+template <class V>
+mapped_row_reader<V> file_row_reader(const mapped_file &file, int nrow, int ncol, bool big_endian, bool byrow) {
+  if (file.size() < (size_t)nrow * ncol * sizeof(V)) {
+    cpp11::stop("File is too small for a grid of %d x %d values of %d bytes.", nrow, ncol, (int)sizeof(V));
+  }
+
+  const uint16_t one = 1;
+  bool little_endian_host = (*reinterpret_cast<const unsigned char *>(&one) == 1);
+  return mapped_row_reader<V>{file.data(), nrow, ncol, big_endian == little_endian_host, byrow};
+}
+
+[[cpp11::register]]
+cpp11::writable::list isobands_file_impl(cpp11::doubles x, cpp11::doubles y, std::string path, bool integer, int size, bool big_endian, bool byrow, cpp11::doubles value_low, cpp11::doubles value_high, int block_rows) {
+  int nrow = y.size(), ncol = x.size();
+  value_type type = file_value_type(integer, size);
+  mapped_file file(path);
+
+  switch (type) {
+  case values_int16:
+    return stream_isobands(x, y, value_low, value_high, file_row_reader<int16_t>(file, nrow, ncol, big_endian, byrow), block_rows);
+  case values_int32:
+    return stream_isobands(x, y, value_low, value_high, file_row_reader<int32_t>(file, nrow, ncol, big_endian, byrow), block_rows);
+  case values_float:
+    return stream_isobands(x, y, value_low, value_high, file_row_reader<float>(file, nrow, ncol, big_endian, byrow), block_rows);
+  default:
+    return stream_isobands(x, y, value_low, value_high, file_row_reader<double>(file, nrow, ncol, big_endian, byrow), block_rows);
+  }
+}
+
+[[cpp11::register]]
+cpp11::writable::list isolines_file_impl(cpp11::doubles x, cpp11::doubles y, std::string path, bool integer, int size, bool big_endian, bool byrow, cpp11::doubles value, int block_rows) {
+  int nrow = y.size(), ncol = x.size();
+  value_type type = file_value_type(integer, size);
+  mapped_file file(path);
+
+  switch (type) {
+  case values_int16:
+    return stream_isolines(x, y, value, file_row_reader<int16_t>(file, nrow, ncol, big_endian, byrow), block_rows);
+  case values_int32:
+    return stream_isolines(x, y, value, file_row_reader<int32_t>(file, nrow, ncol, big_endian, byrow), block_rows);
+  case values_float:
+    return stream_isolines(x, y, value, file_row_reader<float>(file, nrow, ncol, big_endian, byrow), block_rows);
+  default:
+    return stream_isolines(x, y, value, file_row_reader<double>(file, nrow, ncol, big_endian, byrow), block_rows);
+  }
 }
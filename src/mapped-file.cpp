@@ -0,0 +1,85 @@
+#include "mapped-file.h"
+
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+mapped_file::mapped_file(const string &path) :
+  data_(nullptr), size_(0), file_handle(INVALID_HANDLE_VALUE), mapping_handle(NULL)
+{
+  file_handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file_handle == INVALID_HANDLE_VALUE) {
+    throw runtime_error("Cannot open file '" + path + "'.");
+  }
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file_handle, &size)) {
+    close();
+    throw runtime_error("Cannot determine the size of file '" + path + "'.");
+  }
+  size_ = size.QuadPart;
+  if (size_ == 0) return; // empty files can't be mapped
+
+  mapping_handle = CreateFileMappingA(file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (mapping_handle != NULL) {
+    data_ = static_cast<const unsigned char *>(MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+  }
+  if (data_ == nullptr) {
+    close();
+    throw runtime_error("Cannot map file '" + path + "' into memory.");
+  }
+}
+
+void mapped_file::close() {
+  if (data_) UnmapViewOfFile(data_);
+  if (mapping_handle != NULL) CloseHandle(mapping_handle);
+  if (file_handle != INVALID_HANDLE_VALUE) CloseHandle(file_handle);
+  data_ = nullptr;
+  mapping_handle = NULL;
+  file_handle = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+mapped_file::mapped_file(const string &path) :
+  data_(nullptr), size_(0), fd(-1)
+{
+  fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw runtime_error("Cannot open file '" + path + "'.");
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close();
+    throw runtime_error("Cannot determine the size of file '" + path + "'.");
+  }
+  size_ = st.st_size;
+  if (size_ == 0) return; // empty files can't be mapped
+
+  void *p = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (p == MAP_FAILED) {
+    close();
+    throw runtime_error("Cannot map file '" + path + "' into memory.");
+  }
+  data_ = static_cast<const unsigned char *>(p);
+}
+
+void mapped_file::close() {
+  if (data_) munmap(const_cast<unsigned char *>(data_), size_);
+  if (fd >= 0) ::close(fd);
+  data_ = nullptr;
+  fd = -1;
+}
+
+#endif
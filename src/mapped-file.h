@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+using namespace std;
+
+// Read-only memory map of a whole file. The operating system loads pages on
+// first access and may evict them again under memory pressure, so files can
+// be larger than the available memory. Throws runtime_error if the file can't
+// be opened or mapped.
+class mapped_file {
+  const unsigned char *data_;
+  size_t size_;
+#ifdef _WIN32
+  void *file_handle, *mapping_handle;
+#else
+  int fd;
+#endif
+
+  void close();
+
+public:
+  explicit mapped_file(const string &path);
+  ~mapped_file() {close();}
+
+  mapped_file(const mapped_file &) = delete;
+  mapped_file &operator=(const mapped_file &) = delete;
+
+  const unsigned char *data() const {return data_;}
+  size_t size() const {return size_;}
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Calls work(task, worker) for all tasks 0, ..., n_tasks-1 on a pool of up to
+// n_threads threads, with worker in 0, ..., n_threads-1 identifying the thread.
+// Tasks are handed out one at a time, in order, so threads that finish early
+// pick up the remaining ones. The calling thread acts as worker 0 and calls
+// check() after each of its tasks; this is the only place where it is safe to
+// call into R. The first exception thrown by any task or by check() stops the
+// handing out of tasks and is rethrown on the calling thread once all threads
+// have finished.
+template <typename Work, typename Check>
+void parallel_for(int n_tasks, int n_threads, Work work, Check check) {
+  if (n_threads > n_tasks) n_threads = n_tasks;
+  if (n_threads < 1) n_threads = 1;
+
+  atomic<int> next_task(0);
+  atomic<bool> abort(false);
+  exception_ptr error;
+  mutex error_mutex;
+
+  auto run = [&](int worker) {
+    try {
+      for (int task = next_task++; task < n_tasks && !abort; task = next_task++) {
+        work(task, worker);
+        if (worker == 0) check();
+      }
+    } catch (...) {
+      lock_guard<mutex> lock(error_mutex);
+      if (!error) error = current_exception();
+      abort = true;
+    }
+  };
+
+  vector<thread> pool;
+  pool.reserve(n_threads - 1);
+  try {
+    for (int i = 1; i < n_threads; i++) {
+      pool.emplace_back(run, i);
+    }
+  } catch (...) {
+    // could not start a thread; shut down the ones that are running
+    abort = true;
+    for (auto &t : pool) t.join();
+    throw;
+  }
+
+  run(0);
+  for (auto &t : pool) t.join();
+
+  if (error) rethrow_exception(error);
+}
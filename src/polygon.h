@@ -2,6 +2,8 @@
 
 #include <vector>
 #include <ostream>
+#include <algorithm>
+#include <cmath>
 
 using namespace std;
 
@@ -22,3 +24,37 @@ enum in_polygon_type {
   outside,      // point is outside a polygon
   undetermined // point lies right on the boundary
 };
+
+// running measurements of a path, taken one vertex at a time: twice its signed
+// area, positive for paths running counterclockwise, its length, and its bounding
+// box. Coordinates are taken relative to the first vertex, which keeps the cross
+// products small. The edge closing a ring adds nothing to its area, but to its
+// length, see closed_length().
+struct path_measure {
+  double area2 = 0;
+  double length = 0;
+  double xmin = 0, xmax = 0, ymin = 0, ymax = 0;
+  point first, last;
+  bool empty = true;
+
+  void add(const point &p) {
+    if (empty) {
+      first = p;
+      xmin = xmax = p.x;
+      ymin = ymax = p.y;
+      empty = false;
+    } else {
+      area2 += (last.x - first.x) * (p.y - first.y) - (p.x - first.x) * (last.y - first.y);
+      length += hypot(p.x - last.x, p.y - last.y);
+      xmin = min(xmin, p.x);
+      xmax = max(xmax, p.x);
+      ymin = min(ymin, p.y);
+      ymax = max(ymax, p.y);
+    }
+    last = p;
+  }
+
+  double closed_length() const {
+    return length + hypot(first.x - last.x, first.y - last.y);
+  }
+};
@@ -6,9 +6,12 @@
 
 //#include <testthat.h>
 
+#include <algorithm>
+#include <cmath>
+#include <functional>
 #include <iostream>
+#include <queue>
 #include <vector>
-#include <set>
 
 using namespace std;
 
@@ -169,82 +172,173 @@ in_polygon_type polygon_in_polygon(const polygon &query, const polygon &referenc
 }
 
 
-class polygon_hierarchy {
+box bounding_box(const polygon &poly) {
+  box b = {poly[0].x, poly[0].x, poly[0].y, poly[0].y};
+  for (auto it = poly.begin(); it != poly.end(); it++) {
+    b.xmin = min(b.xmin, it->x);
+    b.xmax = max(b.xmax, it->x);
+    b.ymin = min(b.ymin, it->y);
+    b.ymax = max(b.ymax, it->y);
+  }
+  return b;
+}
+
+
+/* Static R-tree over the bounding boxes of polygons, packed bottom-up with the
+ * sort-tile-recursive method: the boxes are sorted into vertical slices by x and
+ * within each slice by y, and grouped into nodes, which are in turn grouped the
+ * same way. Finding the boxes that contain a given box then only visits nodes
+ * that contain it, i.e., that overlap it in both x and y.
+ */
+class box_tree {
 private:
-  // for each polygon, contains a set of exterior polygons
-  vector<set<int>> ext_polygons;
-  vector<bool> active_polygons;
+  static const size_t node_size = 16;
+
+  // a box and what it refers to: on the bottom level, the polygon; on higher
+  // levels, the node of the level below holding the entries
+  // ref * node_size ... ref * node_size + node_size - 1
+  struct entry {
+    box b;
+    int ref;
+  };
+
+  const vector<box> &boxes;
+  vector<vector<entry>> levels;
+
+  static void tile(vector<entry> &v) {
+    size_t n_nodes = (v.size() + node_size - 1) / node_size;
+    size_t slice = (size_t)ceil(sqrt((double)n_nodes)) * node_size;
+
+    sort(v.begin(), v.end(), [](const entry &a, const entry &b) {
+      return a.b.xmin + a.b.xmax < b.b.xmin + b.b.xmax;
+    });
+    for (size_t s = 0; s < v.size(); s += slice) {
+      sort(v.begin() + s, v.begin() + min(s + slice, v.size()), [](const entry &a, const entry &b) {
+        return a.b.ymin + a.b.ymax < b.b.ymin + b.b.ymax;
+      });
+    }
+  }
 
-public:
-  polygon_hierarchy(int n) {
-    ext_polygons.resize(n);
-    active_polygons.resize(n);
+  template <typename F>
+  void visit(size_t level, size_t first, size_t last, int i, F &f) const {
+    const box &b = boxes[i];
+    for (size_t k = first; k < last; k++) {
+      const entry &e = levels[level][k];
+      if (!e.b.contains(b)) continue;
 
-    // initially, all polygons are active
-    for (auto it = active_polygons.begin(); it != active_polygons.end(); it++) {
-      *it = true;
+      if (level == 0) {
+        if (e.ref != i) f(e.ref);
+      } else {
+        size_t child = e.ref * node_size;
+        visit(level - 1, child, min(child + node_size, levels[level - 1].size()), i, f);
+      }
     }
   }
 
-  void print() {
-    for (unsigned int i = 0; i < ext_polygons.size(); i++) {
-      cout << "polygon " << i << " (active = " << active_polygons[i] << ")" << endl;
-      cout << "  enclosing: ";
-      for (auto it = ext_polygons[i].begin(); it != ext_polygons[i].end(); it++) {
-        cout << (*it) << " ";
+public:
+  box_tree(const vector<box> &boxes) : boxes(boxes), levels(1) {
+    for (unsigned int i = 0; i < boxes.size(); i++) {
+      levels[0].push_back({boxes[i], (int)i});
+    }
+    tile(levels[0]);
+
+    while (levels.back().size() > node_size) {
+      const vector<entry> &below = levels.back();
+      vector<entry> above;
+      for (size_t first = 0; first < below.size(); first += node_size) {
+        size_t last = min(first + node_size, below.size());
+        box b = below[first].b;
+        for (size_t k = first + 1; k < last; k++) {
+          b.xmin = min(b.xmin, below[k].b.xmin);
+          b.xmax = max(b.xmax, below[k].b.xmax);
+          b.ymin = min(b.ymin, below[k].b.ymin);
+          b.ymax = max(b.ymax, below[k].b.ymax);
+        }
+        above.push_back({b, (int)(first / node_size)});
       }
-      cout << endl;
+      tile(above);
+      levels.push_back(move(above));
+    }
+  }
+
+  // calls f(j) for every box j other than box i that contains box i
+  template <typename F>
+  void containing(int i, F f) const {
+    visit(levels.size() - 1, 0, levels.back().size(), i, f);
+  }
+};
+
+
+class polygon_hierarchy {
+private:
+  // pairs of polygons and their exterior polygons, until the forest is built
+  vector<pair<int, int>> exteriors;
+  // for each polygon, the number of exterior polygons and the innermost one
+  // (-1 if none), and the polygons directly inside it
+  vector<int> depth;
+  vector<int> parent;
+  vector<vector<int>> children;
+  // top-level polygons not yet returned, smallest index first
+  priority_queue<int, vector<int>, greater<int>> top_level;
+
+public:
+  polygon_hierarchy(int n) : depth(n, 0), parent(n, -1), children(n) {}
+
+  void print() {
+    for (unsigned int i = 0; i < parent.size(); i++) {
+      cout << "polygon " << i << " (depth = " << depth[i] << ")" << endl;
+      cout << "  parent: " << parent[i] << endl;
     }
   }
 
   void set_exterior(int poly, int exterior) {
-    ext_polygons[poly].insert(exterior);
+    exteriors.push_back(make_pair(poly, exterior));
+    depth[poly]++;
   }
 
-  void remove(int poly) {
-    for (auto it = ext_polygons.begin(); it != ext_polygons.end(); it++) {
-      it->erase(poly);
+  // link each polygon to its innermost exterior polygon, which is the one
+  // with the most exterior polygons itself; called once all exterior
+  // polygons have been set
+  void build() {
+    for (auto it = exteriors.begin(); it != exteriors.end(); it++) {
+      int &p = parent[it->first];
+      if (p < 0 || depth[it->second] > depth[p]) {
+        p = it->second;
+      }
+    }
+    exteriors.clear();
+    exteriors.shrink_to_fit();
+
+    for (unsigned int i = 0; i < parent.size(); i++) {
+      if (parent[i] < 0) {
+        top_level.push(i);
+      } else {
+        children[parent[i]].push_back(i);
+      }
     }
   }
 
   // returns the next top level polygon found
   int top_level_poly() {
-    unsigned int i = 0;
-    do {
-      if (active_polygons[i] && ext_polygons[i].empty()) {
-        active_polygons[i] = false;
-        break;
-      }
-      i++;
-    } while (i < ext_polygons.size());
-    if (i == ext_polygons.size()) {
+    if (top_level.empty()) {
       // we have run out of top-level polygons, hence we're done
-      i = -1;
+      return -1;
     }
 
+    int i = top_level.top();
+    top_level.pop();
     return i;
   }
 
-  // find all holes belonging to polygon, remove them and the parent
-  // polygon from the hierarchy, and return
-  set<int> collect_holes(int poly) {
-    set<int> holes;
-
-    unsigned int i = 0;
-    do {
-      if (active_polygons[i] &&
-          ext_polygons[i].size() == 1 &&
-          ext_polygons[i].count(poly) == 1) {
-        holes.insert(i);
-        active_polygons[i] = false;
-      }
-      i++;
-    } while (i < ext_polygons.size());
-
+  // return the holes belonging to polygon; the polygons inside these
+  // holes become top-level polygons
+  const vector<int> &collect_holes(int poly) {
+    const vector<int> &holes = children[poly];
     for (auto it = holes.begin(); it != holes.end(); it++) {
-      remove(*it);
+      for (auto it2 = children[*it].begin(); it2 != children[*it].end(); it2++) {
+        top_level.push(*it2);
+      }
     }
-    remove(poly);
 
     return holes;
   }
@@ -286,32 +380,22 @@ cpp11::writable::doubles_matrix<> polygon_as_matrix(polygon p, bool reverse = fa
   return m;
 }
 
-[[cpp11::register]]
-cpp11::writable::list separate_polygons(cpp11::doubles x, cpp11::doubles y, cpp11::integers id) {
-  cpp11::writable::list out; // final result
-  out.reserve(1); // force list so attributes can be set
-  out.attr("class") = {"XY", "MULTIPOLYGON", "sfg"};
-  int n = x.size();
-  if (n == 0) {
-    return out;
-  }
-  if (y.size() != n || id.size() != n) {
-    cpp11::stop("Inputs x, y, and id must be of the same length.");
-  }
-
-  double* x_p = REAL(x);
-  double* y_p = REAL(y);
-  int* id_p = INTEGER(id);
+// the rings given by n points with coordinates x_p and y_p, one ring for each
+// run of points with the same id, closed if necessary; the ids of the rings are
+// written to ids
+static vector<polygon> rings_of(const double *x_p, const double *y_p, const int *id_p, int n, vector<int> &ids) {
   // create polygons from input data
   vector<polygon> polys;
   int cur_id = id_p[0];
   int cur_poly = 0;
   polys.push_back(polygon());
+  ids.push_back(cur_id);
   for (int i = 0; i<n; i++) {
     if (id_p[i] != cur_id) {
       // complete current polygon and start new one
       polys.push_back(polygon());
       cur_id = id_p[i];
+      ids.push_back(cur_id);
       cur_poly += 1;
     }
     polys[cur_poly].push_back(point(x_p[i], y_p[i]));
@@ -323,15 +407,42 @@ cpp11::writable::list separate_polygons(cpp11::doubles x, cpp11::doubles y, cpp1
       it->push_back(it->front());
     }
   }
+  return polys;
+}
+
+[[cpp11::register]]
+cpp11::writable::list separate_polygons(cpp11::doubles x, cpp11::doubles y, cpp11::integers id) {
+  cpp11::writable::list out; // final result
+  out.reserve(1); // force list so attributes can be set
+  out.attr("class") = {"XY", "MULTIPOLYGON", "sfg"};
+  int n = x.size();
+  if (n == 0) {
+    return out;
+  }
+  if (y.size() != n || id.size() != n) {
+    cpp11::stop("Inputs x, y, and id must be of the same length.");
+  }
+
+  vector<int> ids;
+  vector<polygon> polys = rings_of(REAL(x), REAL(y), INTEGER(id), n, ids);
 
-  // set up polygon hierarchy
-  polygon_hierarchy hi(polys.size());
-  for (unsigned int i = 0; i < polys.size(); i++) {
-    cpp11::check_user_interrupt();
+  // bounding boxes; a polygon can only lie inside another if its box does
+  int n_polys = polys.size();
+  vector<box> boxes(n_polys);
+  for (int i = 0; i < n_polys; i++) {
+    boxes[i] = bounding_box(polys[i]);
+  }
 
-    for (unsigned int j = 0; j < polys.size(); j++ ) {
-      if (i == j) continue;
+  // set up polygon hierarchy, testing each polygon only against the polygons
+  // whose boxes contain its box
+  box_tree tree(boxes);
+  polygon_hierarchy hi(n_polys);
+  for (int i = 0; i < n_polys; i++) {
+    if (i % 1000 == 0) {
+      cpp11::check_user_interrupt();
+    }
 
+    tree.containing(i, [&](int j) {
       in_polygon_type result = polygon_in_polygon(polys[i], polys[j]);
       //cout << "polygon " << i << " is " << result << " of polygon " << j << endl;
 
@@ -341,8 +452,9 @@ cpp11::writable::list separate_polygons(cpp11::doubles x, cpp11::doubles y, cpp1
       else if (result == undetermined){
         cpp11::stop("Found polygons without undefined interior/exterior relationship.");
       }
-    }
+    });
   }
+  hi.build();
 
   int next_poly = hi.top_level_poly();
   int i = 0;
@@ -358,7 +470,7 @@ cpp11::writable::list separate_polygons(cpp11::doubles x, cpp11::doubles y, cpp1
     bool valid_poly = is_valid_ring(polys[next_poly]);
 
     // collect the holes, if any
-    set<int> holes = hi.collect_holes(next_poly);
+    const vector<int> &holes = hi.collect_holes(next_poly);
 
     // record the polygon if valid
     if (valid_poly) {
@@ -383,6 +495,62 @@ cpp11::writable::list separate_polygons(cpp11::doubles x, cpp11::doubles y, cpp1
   return(out);
 }
 
+/* Assemble the rings of an isoband into polygons, given the id of the outer ring
+ * of each ring, as recorded by isobands(). The rings must be numbered 1, 2, ...
+ * in the order they come in, and every outer ring must be its own outer ring.
+ * Gives the polygons that separate_polygons() finds, in linear time and in the
+ * order of their outer rings, or NULL if parent doesn't fit the rings.
+ */
+[[cpp11::register]]
+cpp11::sexp assemble_polygons(cpp11::doubles x, cpp11::doubles y, cpp11::integers id, cpp11::integers parent) {
+  cpp11::writable::list out; // final result
+  out.reserve(1); // force list so attributes can be set
+  out.attr("class") = {"XY", "MULTIPOLYGON", "sfg"};
+  int n = x.size();
+  if (y.size() != n || id.size() != n) {
+    cpp11::stop("Inputs x, y, and id must be of the same length.");
+  }
+  if (n == 0) {
+    return (parent.size() == 0) ? cpp11::sexp(out) : cpp11::sexp(R_NilValue);
+  }
+
+  vector<int> ids;
+  vector<polygon> polys = rings_of(REAL(x), REAL(y), INTEGER(id), n, ids);
+  int n_polys = polys.size();
+  if (parent.size() != n_polys) {
+    return R_NilValue;
+  }
+  const int *parent_p = INTEGER(parent);
+  vector<vector<int>> holes(n_polys);
+  for (int i = 0; i < n_polys; i++) {
+    int p = parent_p[i];
+    if (ids[i] != i + 1 || p == NA_INTEGER || p < 1 || p > n_polys || parent_p[p - 1] != p) {
+      return R_NilValue;
+    }
+    if (p != i + 1) holes[p - 1].push_back(i);
+  }
+
+  for (int i = 0; i < n_polys; i++) {
+    if (i % 1000 == 0) {
+      cpp11::check_user_interrupt();
+    }
+    if (parent_p[i] != i + 1 || !is_valid_ring(polys[i])) continue;
+
+    cpp11::writable::list rings;
+    rings.reserve(holes[i].size() + 1);
+    rings.push_back(polygon_as_matrix(polys[i]));
+    for (auto it = holes[i].begin(); it != holes[i].end(); it++) {
+      if (is_valid_ring(polys[*it])) {
+        // we reverse holes so they run in the same direction as outer polygons
+        rings.push_back(polygon_as_matrix(polys[*it], true));
+      }
+    }
+    out.push_back(rings);
+  }
+
+  return out;
+}
+
 // testing code
 /*** R
 m <- matrix(c(0, 0, 0, 0, 0, 0,
@@ -2,6 +2,15 @@
 
 #include "polygon.h"
 
+// axis-aligned bounding box of a polygon
+struct box {
+  double xmin, xmax, ymin, ymax;
+
+  // does the other box lie within this one, boundary included?
+  bool contains(const box &other) const {
+    return xmin <= other.xmin && other.xmax <= xmax && ymin <= other.ymin && other.ymax <= ymax;
+  }
+};
 
 /* Calculate the number of times a ray extending from point P to the right
  * intersects with the line segment defined by p0, p1. This number is
@@ -28,3 +37,7 @@ in_polygon_type polygon_in_polygon(const polygon &query, const polygon &referenc
  * not all of which are the same).
  */
 bool is_valid_ring(const polygon &poly);
+
+/* Calculate the bounding box of a polygon with at least one point.
+ */
+box bounding_box(const polygon &poly);